@@ -1,5 +1,6 @@
 import cmd, sys
 import socket
+import struct
 import readline
 import time
 
@@ -11,22 +12,90 @@ class ServerShell(cmd.Cmd):
     def __init__(self, server: str, port: intro) -> None:
         super().__init__()
         self.file = socket.create_connection((server, port))
+        self.next_id = 0
+
+    def recv_exact(self, size: int) -> bytes:
+        buffer = b''
+        while len(buffer) < size:
+            chunk = self.file.recv(min(size - len(buffer), 65536))
+            if not chunk:
+                raise ConnectionError('server closed the connection')
+            buffer += chunk
+        return buffer
+
+    # frames are [u32 length][u32 id][payload], little endian
+    def send_request(self, sql: str) -> int:
+        self.next_id += 1
+        payload = sql.encode('utf-8')
+        self.file.sendall(len(payload).to_bytes(4, 'little') +
+                          self.next_id.to_bytes(4, 'little') + payload)
+        return self.next_id
+
+    # answers are data frames [u32 length][u32 id]['D'][rows] followed by
+    # an end frame [u32 length][u32 id]['E'][row count], or by an error
+    # frame [u32 length][u32 id]['X'][message] when the request failed
+    def recv_frame(self):
+        header = self.recv_exact(9)
+        size = int.from_bytes(header[:4], 'little')
+        req_id = int.from_bytes(header[4:8], 'little')
+        return req_id, header[8:9], self.recv_exact(size)
+
+    # "format binary" answers with a schema frame
+    # [u16 columns]([u8 type][u32 length][name])... and batch frames
+    # [u32 rows] then each column: int64 values or [u32 length][bytes]
+    def decode_schema(self, buffer: bytes):
+        (ncols,) = struct.unpack_from('<H', buffer, 0)
+        pos, schema = 2, []
+        for _ in range(ncols):
+            kind, size = struct.unpack_from('<BI', buffer, pos)
+            pos += 5
+            schema.append((buffer[pos:pos + size].decode('utf-8'), kind))
+            pos += size
+        return schema
+
+    def decode_batch(self, buffer: bytes, schema):
+        (nrows,) = struct.unpack_from('<I', buffer, 0)
+        pos, columns = 4, []
+        for _, kind in schema:
+            if kind == 1:
+                columns.append(struct.unpack_from('<%dq' % nrows, buffer, pos))
+                pos += 8 * nrows
+            else:
+                values = []
+                for _ in range(nrows):
+                    (size,) = struct.unpack_from('<I', buffer, pos)
+                    values.append(buffer[pos + 4:pos + 4 + size].decode('utf-8'))
+                    pos += 4 + size
+                columns.append(values)
+        return list(zip(*columns))
 
     def default(self, line: str):
         if line == 'EOF':
             sys.exit(0)
         
         start = time.time()
-        self.file.send(line.encode('utf-8'))
-        size = self.file.recv(4)
-        size = int.from_bytes(size, 'little')
-
-        buffer = b''
-        while len(buffer) < size:
-            buffer += self.file.recv(8192)
+        req_id = self.send_request(line)
+        first_row = None
+        schema = None
+        while True:
+            resp_id, kind, buffer = self.recv_frame()
+            if resp_id != req_id:
+                continue
+            if first_row is None:
+                first_row = time.time()
+            if kind == b'S':
+                schema = self.decode_schema(buffer)
+                print('\t'.join(name for name, _ in schema))
+            elif kind == b'B':
+                for row in self.decode_batch(buffer, schema):
+                    print('\t'.join(map(str, row)))
+            else:
+                print(buffer.decode('utf-8'), end='')
+            if kind in (b'E', b'X'):
+                break
         end = time.time()
 
-        print(buffer.decode('utf-8'))
+        print("First frame after:", first_row - start, "seconds")
         print("Time elapsed:", end - start, "seconds")
 
 
@@ -14,6 +14,43 @@ struct AppConfig
   std::string sqldb_filename;
   std::string sqldb_initfile;
   std::string frag_filename;
+
+  // group commit of small inserts, off while insert_buffer_rows is 0. a
+  // config setting ms with rows 0, or rows over insert_batch_rows, is
+  // rejected
+  size_t insert_buffer_rows = 0;
+  unsigned insert_buffer_ms = 0;
+
+  // index advice thresholds; indexes are created in the background, one per
+  // interval, only while index_advisor_interval_ms is not 0
+  size_t index_advisor_min_hits = 20;
+  double index_advisor_max_selectivity = 0.1;
+  unsigned index_advisor_interval_ms = 0;
+
+  // requests one cli connection may have running at once
+  size_t cli_max_inflight = 16;
+
+  // cli requests longer than this close their connection
+  uint32_t cli_max_frame_bytes = 16 << 20;
+
+  // cli cursors not fetched from for this long are closed
+  unsigned cli_cursor_idle_ms = 60000;
+
+  // cli queries running at once per class. analytic queries also share
+  // cli_query_memory_mb, each being expected to hold cli_fragment_read_kb
+  // per fragment it reads
+  size_t cli_max_interactive = 64;
+  size_t cli_max_analytic = 4;
+  size_t cli_max_imports = 1;
+  size_t cli_query_memory_mb = 256;
+  size_t cli_fragment_read_kb = 4096;
+
+  // rpc requests from other sites served at once per queue, and memory of
+  // received requests past which the rpc server stops reading
+  size_t rpc_max_scans = 16;
+  size_t rpc_max_query_nodes = 32;
+  size_t rpc_max_inserts = 8;
+  size_t rpc_server_memory_mb = 128;
 };
 
 #endif
@@ -0,0 +1,58 @@
+#ifndef _FAIR_QUEUE_HH
+#define _FAIR_QUEUE_HH
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include <seastar/core/future.hh>
+
+// admits up to limit requests at once. waiting requests are granted round
+// robin between the sources that sent them, so one coordinator fanning out
+// a large query cannot take every slot from the others
+class FairQueue {
+  size_t available;
+  std::map<std::string, std::deque<seastar::promise<>>> waiting;
+  // source granted last, the next grant goes to the one after it
+  std::string last;
+
+  seastar::future<> wait(const std::string &source) {
+    if (available && waiting.empty()) {
+      available--;
+      return seastar::make_ready_future<>();
+    }
+
+    auto &queue = waiting[source];
+    queue.emplace_back();
+    return queue.back().get_future();
+  }
+
+  void signal() {
+    if (waiting.empty()) {
+      available++;
+      return;
+    }
+
+    auto it = waiting.upper_bound(last);
+    if (it == waiting.end())
+      it = waiting.begin();
+    last = it->first;
+
+    auto granted = std::move(it->second.front());
+    it->second.pop_front();
+    if (it->second.empty())
+      waiting.erase(it);
+    granted.set_value();
+  }
+
+public:
+  explicit FairQueue(size_t limit) : available(limit) {}
+
+  // runs func once source is granted a slot, which is held until the
+  // future func returns resolves
+  template <typename Func> auto run(const std::string &source, Func func) {
+    return wait(source).then(std::move(func)).finally([this] { signal(); });
+  }
+};
+
+#endif
@@ -0,0 +1,200 @@
+#ifndef _INDEX_ADVISOR_HH
+#define _INDEX_ADVISOR_HH
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+// watches the statements one sqlite database runs against its fragments and
+// suggests single column indexes for columns that are filtered on often and
+// return few of the fragment's rows
+class IndexAdvisor {
+public:
+  struct Advice {
+    std::string fragment;
+    std::string column;
+    size_t hits;
+    double selectivity;
+    double avg_ms;
+  };
+
+private:
+  // fragment and where columns of one sql text
+  struct Shape {
+    std::string fragment;
+    std::vector<std::string> columns;
+  };
+
+  struct ColumnStats {
+    size_t hits = 0;
+    size_t rows = 0;
+    std::chrono::microseconds elapsed{0};
+  };
+
+  static constexpr size_t max_shapes = 1024;
+
+  // fragments without analyze statistics are counted at most this often,
+  // as count(*) reads the whole fragment
+  static constexpr std::chrono::minutes count_refresh{10};
+
+  std::unordered_map<std::string, Shape> shapes;
+  std::map<std::pair<std::string, std::string>, ColumnStats> stats;
+  std::map<std::string,
+           std::pair<int64_t, std::chrono::steady_clock::time_point>>
+      counted;
+
+  // the statements come from build_read_table_sql and the delete/update
+  // paths: "... from <frag> where true and <col> op ? and <key> in (...)"
+  static Shape parse(const std::string &sql) {
+    Shape shape;
+    std::vector<std::string> tokens;
+    boost::split(tokens, sql, boost::is_any_of(" \t\n;(),"),
+                 boost::token_compress_on);
+
+    bool in_where = false;
+    for (size_t i = 0; i + 1 < tokens.size(); i++) {
+      auto &&next = tokens[i + 1];
+
+      if (tokens[i] == "from" || tokens[i] == "update") {
+        shape.fragment = next;
+      } else if (tokens[i] == "where") {
+        in_where = true;
+      } else if (!in_where || tokens[i] != "and") {
+        continue;
+      }
+
+      // rowid bounds come from cursor pages
+      if (in_where && next != "true" && next != "rowid") {
+        auto dot = next.find('.');
+        shape.columns.push_back(
+            dot == std::string::npos ? next : next.substr(dot + 1));
+      }
+    }
+
+    return shape;
+  }
+
+  static bool has_leading_index(SQLite::Database &db,
+                                const std::string &fragment,
+                                const std::string &column) {
+    std::vector<std::string> names;
+    SQLite::Statement list(db, "select name from pragma_index_list(?)");
+    list.bind(1, fragment);
+    while (list.executeStep())
+      names.push_back(list.getColumn(0));
+
+    for (auto &&name : names) {
+      SQLite::Statement info(db, "select name from pragma_index_info(?) "
+                                 "where seqno = 0");
+      info.bind(1, name);
+      if (info.executeStep() && info.getColumn(0).getString() == column)
+        return true;
+    }
+
+    return false;
+  }
+
+  // the first number of a sqlite_stat1 row is the row count of its table
+  int64_t fragment_rows(SQLite::Database &db, const std::string &fragment,
+                        bool analyzed) {
+    if (analyzed) {
+      SQLite::Statement stat(db,
+                             "select stat from sqlite_stat1 where tbl = ?");
+      stat.bind(1, fragment);
+      if (stat.executeStep())
+        return std::atoll(stat.getColumn(0).getString().c_str());
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    auto it = counted.find(fragment);
+    if (it == counted.end() || now - it->second.second > count_refresh) {
+      SQLite::Statement count(db, "select count(*) from " + fragment);
+      int64_t rows = count.executeStep() ? count.getColumn(0).getInt64() : 0;
+      it = counted.insert_or_assign(fragment, std::make_pair(rows, now)).first;
+    }
+
+    return it->second.first;
+  }
+
+public:
+  void observe(const std::string &sql, size_t rows,
+               std::chrono::microseconds elapsed) {
+    auto it = shapes.find(sql);
+    if (it == shapes.end()) {
+      if (shapes.size() >= max_shapes)
+        shapes.clear();
+      it = shapes.emplace(sql, parse(sql)).first;
+    }
+
+    auto &&shape = it->second;
+    if (shape.fragment.empty())
+      return;
+
+    for (auto &&column : std::set<std::string>(shape.columns.begin(),
+                                               shape.columns.end())) {
+      auto &s = stats[{shape.fragment, column}];
+      s.hits++;
+      s.rows += rows;
+      s.elapsed += elapsed;
+    }
+  }
+
+  // columns filtered at least min_hits times that on average match at most
+  // max_selectivity of their fragment, most expensive first. fragment
+  // sizes come from analyze statistics where there are any, so advice
+  // does not scan fragments each time it is asked for
+  std::vector<Advice> advise(SQLite::Database &db, size_t min_hits,
+                             double max_selectivity) {
+    std::vector<Advice> ret;
+    std::map<std::string, int64_t> rows;
+
+    SQLite::Statement stat_table(db, "select 1 from sqlite_master where "
+                                     "name = 'sqlite_stat1'");
+    bool analyzed = stat_table.executeStep();
+
+    for (auto &&[key, s] : stats) {
+      auto &&[fragment, column] = key;
+      if (s.hits < min_hits)
+        continue;
+
+      if (!rows.count(fragment))
+        rows[fragment] = fragment_rows(db, fragment, analyzed);
+
+      auto total = rows[fragment];
+      if (total == 0)
+        continue;
+
+      double selectivity = (double)s.rows / s.hits / total;
+      if (selectivity > max_selectivity ||
+          has_leading_index(db, fragment, column))
+        continue;
+
+      ret.push_back({fragment, column, s.hits, selectivity,
+                     s.elapsed.count() / 1000.0 / s.hits});
+    }
+
+    std::sort(ret.begin(), ret.end(), [](auto &&a, auto &&b) {
+      return a.avg_ms * a.hits > b.avg_ms * b.hits;
+    });
+
+    return ret;
+  }
+
+  // start counting afresh, e.g. once the column got its index
+  void forget(const std::string &fragment, const std::string &column) {
+    stats.erase({fragment, column});
+  }
+};
+
+#endif
@@ -2,6 +2,7 @@
 
 #define _PARSE_SQL_HH
 
+#include <cstdint>
 #include <hsql/sql/Expr.h>
 #include <map>
 #include <memory>
@@ -9,6 +10,7 @@
 #include <set>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -50,6 +52,31 @@ struct CompareConds {
   std::variant<int64_t, std::string> val2;
 };
 
+// hfrag predicates of a table compiled for bulk routing. int columns are cut
+// into intervals at every predicate bound, string columns are hashed into
+// the values they are compared with, and a dense table maps each
+// combination of interval and value to the index of the fragment holding it
+struct FragRouter {
+  struct IntColumn {
+    std::string name;
+    std::vector<int64_t> bounds;
+  };
+
+  struct StrColumn {
+    std::string name;
+    std::unordered_map<std::string, int> values;
+  };
+
+  // false when the predicates cannot be compiled, e.g. ranges on strings
+  bool compiled = false;
+  std::vector<std::string> frag_sites;
+  std::vector<IntColumn> int_columns;
+  std::vector<StrColumn> str_columns;
+  // int columns first, then string columns
+  std::vector<size_t> strides;
+  std::vector<int> cells;
+};
+
 struct TableMetadata {
   enum { HFRAG, VFRAG };
 
@@ -62,6 +89,13 @@ struct TableMetadata {
       hfrag_conds;
   std::map<std::string, std::tuple<std::string, std::vector<std::string>>>
       vfrag_cols;
+  // index name, indexed columns
+  std::map<std::string, std::vector<std::string>> indexes;
+  // key column of the global key index, empty without one
+  std::string pk_index;
+
+  // built on first use, reset when hfrag_conds change
+  std::shared_ptr<FragRouter> router;
 };
 
 struct DatabaseMetadata {
@@ -84,6 +118,13 @@ struct InsertStmt {
 
 struct DeleteStmt {
   std::string table_name;
+  std::vector<CompareConds> conds;
+};
+
+struct UpdateStmt {
+  std::string table_name;
+  std::vector<std::tuple<std::string, std::variant<int64_t, std::string>>> sets;
+  std::vector<CompareConds> conds;
 };
 
 struct BasicNode {
@@ -541,6 +582,11 @@ void pushDownAndOptimize(BasicNode *now,
                          std::optional<std::set<std::string>> proj_cols,
                          std::vector<CompareConds> sel_conds,
                          std::string single_table_name, DatabaseMetadata *db);
+bool condsUnsatisfiable(const std::vector<CompareConds> &conds);
+std::vector<CompareConds> processWhereConds(hsql::Expr *where);
+DeleteStmt parseDeleteStmt(std::string sql, DatabaseMetadata *db);
+UpdateStmt parseUpdateStmt(std::string sql, DatabaseMetadata *db);
+std::string vfragJoinColumn(TableMetadata &table_info);
 void processCreateMeta(std::string create_frag_stmt, DatabaseMetadata *db);
 void printSelectStmt(SelectStmt result);
 std::shared_ptr<BasicNode> buildDistributedReadNode(std::string tablename,
@@ -558,11 +604,40 @@ int compareVar(std::variant<int64_t, std::string> &l,
 bool checkFragCond(std::vector<std::variant<int64_t, std::string>> &row,
                    std::vector<CompareConds> &conds,
                    std::map<std::string, int> &posmap);
+FragRouter &getFragRouter(TableMetadata &table);
+std::optional<std::vector<int>>
+routeRows(FragRouter &router, std::vector<std::string> &columns,
+          std::vector<std::vector<std::variant<int64_t, std::string>>> &rows);
 std::map<std::string, InsertStmt> insertStmtToSites(InsertStmt &istmt,
                                                     DatabaseMetadata *db);
 InsertStmt insertStmtFromTSV(std::string table, std::string filename,
                              DatabaseMetadata *db);
 
+// reads the tsv lines starting in [begin, end) of a file a chunk of about
+// chunk_bytes at a time, each parsed and routed to its sites on its own,
+// so the rows of the whole range are never held at once
+class TSVChunkReader {
+  std::string table;
+  DatabaseMetadata *db;
+  std::vector<bool> int_columns;
+  const char *data = nullptr;
+  size_t size = 0;
+  const char *now = nullptr, *end = nullptr;
+  size_t chunk_bytes;
+
+public:
+  TSVChunkReader(std::string table, std::string filename,
+                 DatabaseMetadata *db, size_t begin = 0,
+                 size_t end = SIZE_MAX, size_t chunk_bytes = 1 << 20);
+  TSVChunkReader(const TSVChunkReader &) = delete;
+  ~TSVChunkReader();
+
+  // the rows of the next chunk by site, nullopt once the range is read
+  std::optional<std::map<std::string, InsertStmt>> next();
+};
+
+std::optional<InsertStmt> parseSimpleInsertStmt(std::string sql,
+                                                DatabaseMetadata *db);
 InsertStmt parseInsertStmt(std::string sql, DatabaseMetadata *db);
 
 std::vector<std::vector<std::string>>
@@ -573,5 +648,12 @@ dfs_join(std::string key,
 std::map<std::string, std::string>
 parseCreateTable(std::string create_sql, DatabaseMetadata *db,
                  std::vector<std::string> *metas);
+std::map<std::string, std::string>
+parseCreateIndex(std::string create_sql, DatabaseMetadata *db,
+                 std::vector<std::string> *metas);
+std::string parseCreatePkIndex(std::string create_sql, DatabaseMetadata *db,
+                               std::vector<std::string> *metas);
+void pruneReadSites(BasicNode *now, const std::string &table,
+                    const std::set<std::string> &sites);
 
 #endif
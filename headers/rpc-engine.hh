@@ -6,6 +6,8 @@
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/range/irange.hpp>
+#include <algorithm>
 #include <exception>
 #include <filesystem>
 #include <fmt/core.h>
@@ -17,54 +19,163 @@
 #include <string>
 
 #include <seastar/core/future.hh>
+#include <seastar/core/gate.hh>
 #include <seastar/core/loop.hh>
+#include <seastar/core/semaphore.hh>
+#include <seastar/core/shared_future.hh>
 #include <seastar/core/sleep.hh>
 #include <seastar/core/smp.hh>
 #include <seastar/core/thread.hh>
+#include <seastar/core/timer.hh>
 #include <seastar/rpc/rpc.hh>
 
 #include <SQLiteCpp/SQLiteCpp.h>
 
 #include <config.hpp>
+#include <fair-queue.hh>
 #include <queryparser.hh>
 #include <serializer.hpp>
+#include <index-advisor.hh>
+#include <statement-cache.hh>
 
 #include <parsesql.hh>
 
+// every verb takes the name of the database it runs against first
 class SqlRpcEngine {
-  using SqlFunc = std::vector<std::vector<std::string>>(std::string);
-  using InsertFunc = int(std::string, std::vector<std::vector<std::string>>);
-  using ControlFunc = int(std::string, std::string);
-  using RemoteNodeFunc = std::vector<std::vector<std::string>>(std::string,
-                                                               int);
+  using SqlFunc = std::vector<std::vector<std::string>>(
+      std::string, std::string,
+      std::vector<std::variant<int64_t, std::string>>);
+  using SqlBatchFunc = std::vector<std::vector<std::vector<std::string>>>(
+      std::string, std::vector<std::string>,
+      std::vector<std::vector<std::variant<int64_t, std::string>>>);
+  using InsertFunc =
+      int(std::string, std::string, std::vector<std::string>,
+          std::vector<std::vector<std::variant<int64_t, std::string>>>);
+  using ControlFunc = int(std::string, std::string, std::string);
+  using RemoteNodeFunc = std::vector<std::vector<std::string>>(
+      std::string, std::string, std::vector<std::vector<std::string>>, int);
+  using ImportRangeFunc = std::string(std::string, std::string, std::string,
+                                      uint64_t, uint64_t);
+  using AdviseFunc = std::vector<std::vector<std::string>>(std::string);
+  using GidxUpdateFunc =
+      int(std::string, std::string,
+          std::vector<std::variant<int64_t, std::string>>, std::string);
+  using GidxLookupFunc = std::string(std::string, std::string,
+                                     std::variant<int64_t, std::string>);
   AppConfig &config;
-  std::shared_ptr<SQLite::Database> pdb;
-  std::map<std::string, std::shared_ptr<SQLite::Database>> db_conns;
-  std::map<std::string, std::shared_ptr<DatabaseMetadata>> db_metas;
   rpc::protocol<serializer> rpc_proto;
 
   std::unique_ptr<rpc::server> pserver;
   std::map<std::string, std::unique_ptr<rpc::client>> pclients;
 
   decltype(rpc_proto.register_handler(1, (SqlFunc *)nullptr)) rpc_sql_exec;
+  decltype(rpc_proto.register_handler(
+      1, (SqlBatchFunc *)nullptr)) rpc_sql_exec_batch;
   decltype(rpc_proto.register_handler(1,
                                       (InsertFunc *)nullptr)) rpc_insert_exec;
   decltype(rpc_proto.register_handler(1, (ControlFunc *)nullptr)) rpc_control;
   decltype(rpc_proto.register_handler(
       1, (RemoteNodeFunc *)nullptr)) rpc_remotenode;
+  decltype(rpc_proto.register_handler(
+      1, (ImportRangeFunc *)nullptr)) rpc_import_range;
+  decltype(rpc_proto.register_handler(1,
+                                      (AdviseFunc *)nullptr)) rpc_advise_index;
+  decltype(rpc_proto.register_handler(
+      1, (GidxUpdateFunc *)nullptr)) rpc_gidx_update;
+  decltype(rpc_proto.register_handler(
+      1, (GidxLookupFunc *)nullptr)) rpc_gidx_lookup;
+
+  // the sql a plan was built from and, per table, the sites its reads were
+  // pruned to as {table, site...}. numbering the nodes of a plan depends
+  // on the pruning, so a site running a node of it rebuilds the plan from
+  // both
+  struct PlanSource {
+    std::string sql;
+    std::vector<std::vector<std::string>> pruned;
+  };
 
-  DatabaseMetadata *pdb_meta = nullptr;
+  // fragment scans already sent to their site in a per-site batch, waiting
+  // to be picked up by exec_query_node
+  std::map<BasicNode *, seastar::future<std::vector<std::vector<std::string>>>>
+      prefetched_reads;
 
   enum {
     RPC_SQL_EXEC = 1,
     RPC_INSERT_DATA = 2,
     RPC_CONTROL = 3,
-    RPC_EXEC_QUERY_NODE = 4
+    RPC_EXEC_QUERY_NODE = 4,
+    RPC_SQL_EXEC_BATCH = 5,
+    RPC_IMPORT_RANGE = 6,
+    RPC_ADVISE_INDEX = 7,
+    RPC_GIDX_UPDATE = 8,
+    RPC_GIDX_LOOKUP = 9
   };
 
   std::vector<std::string> sites;
 
+  // a database is in bulk mode while any import into it runs; the secondary
+  // indexes of the fragments being loaded are dropped until their load
+  // ends. their sql is kept in the deferred_indexes table, so indexes of a
+  // load cut short by a restart are rebuilt when the database is opened.
+  // the pragmas the database had are put back when the last load ends
+  struct BulkLoad {
+    int loads = 0;
+    std::string journal_mode;
+    int64_t synchronous = 0;
+    int64_t cache_size = 0;
+  };
+
+  // small inserts of all sessions waiting for a group commit, grouped by
+  // database, site, fragment and columns. a group is flushed as one batch
+  // when it reaches insert_buffer_rows rows or insert_buffer_ms after it
+  // opened, and every insert in it is acknowledged when it commits. an
+  // insert that pushes a group past insert_buffer_rows still joins it, so
+  // one transaction may hold more rows than that
+  struct InsertGroup {
+    InsertStmt stmt;
+    seastar::shared_promise<> committed;
+    seastar::timer<> flush_timer;
+  };
+  using InsertGroupKey = std::tuple<std::string, std::string, std::string,
+                                    std::vector<std::string>>;
+  std::map<InsertGroupKey, std::unique_ptr<InsertGroup>> insert_groups;
+
+  // timer that builds the advised indexes one at a time when configured
+  seastar::timer<> index_advisor_timer;
+  bool auto_index_running = false;
+
+  // fragment scans, query nodes and inserts sent by other sites each wait
+  // for slots of their own queue, shared fairly between the coordinators.
+  // query nodes get a queue apart from scans since they send scans
+  // themselves and must not hold the slots those wait for
+  FairQueue scan_queue, node_queue, insert_queue;
+
+  // one database of this site: its sqlite connection, catalog, statement
+  // cache, bulk load state and record of the fragment statements run here.
+  // requests name their database, so sessions on different databases run
+  // side by side and no site has a current database
+  struct DbContext {
+    std::string name;
+    SQLite::Database conn;
+    DatabaseMetadata meta;
+    StatementCache stmts;
+    BulkLoad bulk;
+    IndexAdvisor advisor;
+
+    DbContext(std::string name, std::string filename)
+        : name(name),
+          conn(filename, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE),
+          stmts(conn) {}
+  };
+  std::map<std::string, std::unique_ptr<DbContext>> db_contexts;
+
 public:
+  // inserts are shipped to a site in batches of insert_batch_rows rows, each
+  // committed on its own. a site has at most insert_batch_credits batches in
+  // flight, so a slow receiver throttles the sender
+  static constexpr size_t insert_batch_rows = 10000;
+  static constexpr size_t insert_batch_credits = 2;
+
   void init_db_meta() {
     for (auto &&[sname, sconfig] : config.nodes) {
       sites.push_back(sname);
@@ -78,18 +189,24 @@ public:
     // }
   }
 
-  void add_db_conn(std::string dbname) {
+  // the context of a database, opened and created on its first request.
+  // contexts are never closed, so the pointer stays valid
+  DbContext *db_context(const std::string &dbname) {
+    if (dbname.empty())
+      throw std::runtime_error("no database selected");
+
+    auto &ctx = db_contexts[dbname];
+    if (ctx)
+      return ctx.get();
+
     std::string filename = dbname + "_" + config.name + ".db";
     std::cout << "add sqlite connection: " << filename << std::endl;
 
     bool database_need_init = !std::filesystem::exists(filename);
 
-    auto new_db = std::make_shared<SQLite::Database>(
-        filename, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
-    auto new_meta = std::make_shared<DatabaseMetadata>();
-
-    db_conns[dbname] = new_db;
-    db_metas[dbname] = new_meta;
+    ctx = std::make_unique<DbContext>(dbname, filename);
+    auto new_db = &ctx->conn;
+    auto new_meta = &ctx->meta;
     new_meta->sites = sites;
 
     if (database_need_init) {
@@ -97,60 +214,157 @@ public:
       std::string line = "create table frags (text char(1024));";
       std::cout << line << std::endl;
       new_db->exec(line);
+      new_db->exec(deferred_indexes_table);
       transaction.commit();
     } else {
       try {
         SQLite::Statement query(*new_db, "select text from frags");
 
         while (query.executeStep()) {
-          processCreateMeta(query.getColumn(0), new_meta.get());
+          processCreateMeta(query.getColumn(0), new_meta);
         }
       } catch (std::exception &e) {
         std::cout << e.what() << std::endl;
       }
+
+      new_db->exec(deferred_indexes_table);
+      restore_deferred_indexes(*new_db, "");
     }
+
+    return ctx.get();
+  }
+
+  // coordinators are told apart by the address of their connection
+  static std::string coordinator(const rpc::client_info &info) {
+    std::ostringstream ss;
+    ss << info.addr;
+    return ss.str();
   }
 
-  SqlRpcEngine(AppConfig &config) : config(config), rpc_proto(serializer{}) {
+  SqlRpcEngine(AppConfig &config)
+      : config(config), rpc_proto(serializer{}),
+        scan_queue(config.rpc_max_scans),
+        node_queue(config.rpc_max_query_nodes),
+        insert_queue(config.rpc_max_inserts) {
     init_db_meta();
 
     rpc_proto.register_handler(
-        RPC_SQL_EXEC, [this](std::string sql) { return local_exec_sql(sql); });
+        RPC_SQL_EXEC,
+        [this](const rpc::client_info &info, std::string dbname,
+               std::string sql,
+               std::vector<std::variant<int64_t, std::string>> params) {
+          return scan_queue.run(coordinator(info), [this, dbname, sql,
+                                                    params] {
+            return local_exec_sql(db_context(dbname), sql, params);
+          });
+        });
 
     rpc_proto.register_handler(
-        RPC_INSERT_DATA, [this](std::string tablename,
-                                std::vector<std::vector<std::string>> data) {
-          return local_insert(tablename, data);
+        RPC_SQL_EXEC_BATCH,
+        [this](const rpc::client_info &info, std::string dbname,
+               std::vector<std::string> sqls,
+               std::vector<std::vector<std::variant<int64_t, std::string>>>
+                   params) {
+          return scan_queue.run(coordinator(info), [this, dbname, sqls,
+                                                    params] {
+            return local_exec_sql_batch(db_context(dbname), sqls, params);
+          });
         });
 
-    rpc_proto.register_handler(RPC_CONTROL,
-                               [this](std::string cmd, std::string type) {
-                                 sql_control(cmd, type);
-                                 return 0;
-                               });
+    rpc_proto.register_handler(
+        RPC_INSERT_DATA,
+        [this](const rpc::client_info &info, std::string dbname,
+               std::string tablename, std::vector<std::string> columns,
+               std::vector<std::vector<std::variant<int64_t, std::string>>>
+                   rows) {
+          return insert_queue.run(coordinator(info), [this, dbname, tablename,
+                                                      columns, rows] {
+            return local_insert(db_context(dbname), tablename, columns, rows);
+          });
+        });
 
-    rpc_proto.register_handler(RPC_EXEC_QUERY_NODE,
-                               [this](std::string sql, int ind) {
-                                 return rpc_exec_query_node(sql, ind);
-                               });
+    // close names no database
+    rpc_proto.register_handler(
+        RPC_CONTROL,
+        [this](std::string dbname, std::string cmd, std::string type) {
+          sql_control(dbname.empty() ? nullptr : db_context(dbname), cmd,
+                      type);
+          return 0;
+        });
 
+    rpc_proto.register_handler(
+        RPC_EXEC_QUERY_NODE,
+        [this](const rpc::client_info &info, std::string dbname,
+               std::string sql, std::vector<std::vector<std::string>> pruned,
+               int ind) {
+          return node_queue.run(coordinator(info), [this, dbname, sql,
+                                                    pruned, ind] {
+            return rpc_exec_query_node(db_context(dbname),
+                                       PlanSource{sql, pruned}, ind);
+          });
+        });
+
+    rpc_proto.register_handler(RPC_ADVISE_INDEX, [this](std::string dbname) {
+      return local_advise_index(db_context(dbname));
+    });
+
+    rpc_proto.register_handler(
+        RPC_GIDX_UPDATE,
+        [this](const rpc::client_info &info, std::string dbname,
+               std::string table,
+               std::vector<std::variant<int64_t, std::string>> keys,
+               std::string row_sites) {
+          return insert_queue.run(coordinator(info), [this, dbname, table,
+                                                      keys, row_sites] {
+            return local_gidx_update(db_context(dbname), table, keys,
+                                     row_sites);
+          });
+        });
+
+    rpc_proto.register_handler(
+        RPC_GIDX_LOOKUP, [this](std::string dbname, std::string table,
+                                std::variant<int64_t, std::string> key) {
+          return local_gidx_lookup(db_context(dbname), table, key);
+        });
+
+    rpc_proto.register_handler(
+        RPC_IMPORT_RANGE,
+        [this](std::string dbname, std::string table, std::string filename,
+               uint64_t begin, uint64_t end) {
+          return import_file_range(db_context(dbname), table, filename, begin,
+                                   end);
+        });
+
+    // requests waiting in a queue still count against max_memory, so an
+    // overloaded site stops reading from its peers instead of buffering
+    rpc::resource_limits limits;
+    limits.max_memory = config.rpc_server_memory_mb << 20;
     pserver = std::make_unique<rpc::protocol<serializer>::server>(
         rpc_proto,
-        ipv4_addr{"0.0.0.0", std::get<1>(config.nodes[config.name])});
+        ipv4_addr{"0.0.0.0", std::get<1>(config.nodes[config.name])}, limits);
 
     fmt::print("RPC server started at {}:{}\n", "0.0.0.0",
                std::get<1>(config.nodes[config.name]));
   }
 
   seastar::future<void> clients_init() {
-    rpc_sql_exec =
-        rpc_proto
-            .make_client<std::vector<std::vector<std::string>>(std::string)>(
-                RPC_SQL_EXEC);
+    rpc_sql_exec = rpc_proto.make_client<SqlFunc>(RPC_SQL_EXEC);
+    rpc_sql_exec_batch =
+        rpc_proto.make_client<SqlBatchFunc>(RPC_SQL_EXEC_BATCH);
 
     rpc_insert_exec = rpc_proto.make_client<InsertFunc>(RPC_INSERT_DATA);
     rpc_control = rpc_proto.make_client<ControlFunc>(RPC_CONTROL);
     rpc_remotenode = rpc_proto.make_client<RemoteNodeFunc>(RPC_EXEC_QUERY_NODE);
+    rpc_import_range = rpc_proto.make_client<ImportRangeFunc>(RPC_IMPORT_RANGE);
+    rpc_advise_index = rpc_proto.make_client<AdviseFunc>(RPC_ADVISE_INDEX);
+    rpc_gidx_update = rpc_proto.make_client<GidxUpdateFunc>(RPC_GIDX_UPDATE);
+    rpc_gidx_lookup = rpc_proto.make_client<GidxLookupFunc>(RPC_GIDX_LOOKUP);
+
+    if (config.index_advisor_interval_ms) {
+      index_advisor_timer.set_callback([this]() { auto_create_index(); });
+      index_advisor_timer.arm_periodic(
+          std::chrono::milliseconds(config.index_advisor_interval_ms));
+    }
 
     for (auto [name, info] : config.nodes) {
       pclients.emplace(std::make_pair(
@@ -162,60 +376,241 @@ public:
     return seastar::make_ready_future<>();
   }
 
-  std::vector<std::vector<std::string>> local_exec_sql(std::string sql) {
+  static void bind_params(
+      SQLite::Statement &query,
+      const std::vector<std::variant<int64_t, std::string>> &params) {
+    for (int i = 0; i < params.size(); i++) {
+      if (params[i].index() == 0)
+        query.bind(i + 1, std::get<0>(params[i]));
+      else
+        query.bind(i + 1, std::get<1>(params[i]));
+    }
+  }
+
+  std::vector<std::vector<std::string>>
+  local_exec_sql(DbContext *db, std::string sql,
+                 std::vector<std::variant<int64_t, std::string>> params = {}) {
     fmt::print("RPC sql: {}\n", sql);
     std::vector<std::vector<std::string>> ret;
-    SQLite::Statement query(*pdb, sql);
+    auto start = std::chrono::steady_clock::now();
+    auto query = db->stmts.get(sql);
     ret.emplace_back();
 
-    for (int i = 0, end = query.getColumnCount(); i < end; i++)
-      ret.back().emplace_back(query.getColumnOriginName(i));
+    try {
+      bind_params(*query, params);
 
-    while (query.executeStep()) {
-      ret.emplace_back();
-      for (int i = 0, end = query.getColumnCount(); i < end; i++) {
-        ret.back().emplace_back(query.getColumn(i));
+      for (int i = 0, end = query->getColumnCount(); i < end; i++)
+        ret.back().emplace_back(query->getColumnOriginName(i));
+
+      while (query->executeStep()) {
+        ret.emplace_back();
+        for (int i = 0, end = query->getColumnCount(); i < end; i++) {
+          ret.back().emplace_back(query->getColumn(i));
+        }
       }
+    } catch (...) {
+      query->reset();
+      throw;
     }
+    auto rows =
+        query->getColumnCount() ? ret.size() - 1 : db->conn.getChanges();
+    query->reset();
+
+    db->advisor.observe(
+        sql, rows,
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start));
+
+    return ret;
+  }
+
+  // run sql on the site holding the fragment; the coordinator's own
+  // fragments are read straight from sqlite instead of the rpc loopback
+  seastar::future<std::vector<std::vector<std::string>>>
+  site_exec_sql(DbContext *db, std::string site, std::string sql,
+                std::vector<std::variant<int64_t, std::string>> params = {}) {
+    if (site == config.name)
+      return seastar::make_ready_future<>().then(
+          [this, db, sql, params]() {
+            return local_exec_sql(db, sql, params);
+          });
+
+    return rpc_sql_exec(*pclients[site], db->name, sql, params);
+  }
+
+  std::vector<std::vector<std::vector<std::string>>> local_exec_sql_batch(
+      DbContext *db, std::vector<std::string> sqls,
+      std::vector<std::vector<std::variant<int64_t, std::string>>> params) {
+    std::vector<std::vector<std::vector<std::string>>> ret;
+
+    for (int i = 0; i < sqls.size(); i++)
+      ret.push_back(local_exec_sql(db, sqls[i], params[i]));
 
     return ret;
   }
 
-  int local_insert(std::string table_name,
-                   std::vector<std::vector<std::string>> rows) {
+  seastar::future<std::vector<std::vector<std::vector<std::string>>>>
+  site_exec_sql_batch(
+      DbContext *db, std::string site, std::vector<std::string> sqls,
+      std::vector<std::vector<std::variant<int64_t, std::string>>> params) {
+    if (site == config.name)
+      return seastar::make_ready_future<>().then([this, db, sqls, params]() {
+        return local_exec_sql_batch(db, sqls, params);
+      });
+
+    return rpc_sql_exec_batch(*pclients[site], db->name, sqls, params);
+  }
+
+  // literals are sent as bound parameters so the statement text only
+  // depends on the query shape and stays in the statement cache
+  std::string build_read_table_sql(
+      DbContext *db, ReadTableNode *readtable,
+      std::vector<std::variant<int64_t, std::string>> &params) {
+    auto [site, tablename] = split_column_name(readtable->table_name);
+    auto &&table_meta = db->meta.tables[readtable->orig_table_name];
+
+    std::stringstream sql_ss;
+    sql_ss << "select " << boost::algorithm::join(readtable->column_names, ", ")
+           << " from " << tablename << " where true";
+
+    for (auto cond : readtable->select_conds) {
+      if (table_meta.frag_type == table_meta.VFRAG) {
+        auto &&cols = std::get<1>(table_meta.vfrag_cols[site]);
+        if (std::find(cols.begin(), cols.end(),
+                      std::get<1>(split_column_name(cond.val1))) == cols.end())
+          continue;
+      }
+
+      sql_ss << " and " << cond.val1 << " " << cond.op << " ?";
+      params.push_back(cond.val2);
+    }
+    sql_ss << ";";
+
+    return sql_ss.str();
+  }
+
+  // find the read table nodes exec_query_node will run on this site,
+  // skipping subtrees that are delegated to other sites
+  void collect_read_tables(
+      BasicNode *node,
+      std::map<std::string, std::vector<ReadTableNode *>> &reads) {
+    if (node->disabled)
+      return;
+
+    if (node->exec_on_site.size() && node->exec_on_site != config.name &&
+        (dynamic_cast<NJoinNode *>(node) || dynamic_cast<UnionNode *>(node)))
+      return;
+
+    if (auto projection = dynamic_cast<ProjectionNode *>(node)) {
+      collect_read_tables(projection->child.get(), reads);
+    } else if (auto njoin = dynamic_cast<NJoinNode *>(node)) {
+      for (auto ch : njoin->join_children)
+        collect_read_tables(ch.get(), reads);
+    } else if (auto union_ = dynamic_cast<UnionNode *>(node)) {
+      for (auto ch : union_->union_children)
+        collect_read_tables(ch.get(), reads);
+    } else if (auto rename = dynamic_cast<RenameNode *>(node)) {
+      collect_read_tables(rename->child.get(), reads);
+    } else if (auto readtable = dynamic_cast<ReadTableNode *>(node)) {
+      auto [site, tablename] = split_column_name(readtable->table_name);
+      reads[site].push_back(readtable);
+    }
+  }
+
+  // send every fragment scan of the tree in one request per site, so round
+  // trips are bounded by the number of sites instead of fragments
+  void prefetch_read_tables(DbContext *db, BasicNode *root) {
+    std::map<std::string, std::vector<ReadTableNode *>> reads;
+    collect_read_tables(root, reads);
+
+    for (auto &&[site, readtables] : reads) {
+      std::vector<std::string> sqls;
+      std::vector<std::vector<std::variant<int64_t, std::string>>> params(
+          readtables.size());
+      std::vector<seastar::promise<std::vector<std::vector<std::string>>>>
+          promises(readtables.size());
+
+      for (int i = 0; i < readtables.size(); i++) {
+        sqls.push_back(build_read_table_sql(db, readtables[i], params[i]));
+        prefetched_reads.emplace(readtables[i], promises[i].get_future());
+      }
+
+      (void)site_exec_sql_batch(db, site, sqls, params).then_wrapped(
+          [promises = std::move(promises)](auto fut) mutable {
+            if (fut.failed()) {
+              auto ep = fut.get_exception();
+              for (auto &&p : promises)
+                p.set_exception(ep);
+              return;
+            }
+
+            auto results = fut.get();
+            for (int i = 0; i < promises.size(); i++)
+              promises[i].set_value(std::move(results[i]));
+          });
+    }
+  }
+
+  void drop_prefetched_reads(std::vector<std::shared_ptr<BasicNode>> &nodes) {
+    for (auto &&node : nodes) {
+      auto it = prefetched_reads.find(node.get());
+      if (it != prefetched_reads.end()) {
+        (void)std::move(it->second).handle_exception([](std::exception_ptr) {});
+        prefetched_reads.erase(it);
+      }
+    }
+  }
+
+  // values keep their parsed type down to sqlite3_bind_int64
+  int local_insert(
+      DbContext *db, std::string table_name, std::vector<std::string> columns,
+      std::vector<std::vector<std::variant<int64_t, std::string>>> rows) {
     std::stringstream sql_ss;
     sql_ss << "INSERT INTO " << table_name << " (";
-    sql_ss << boost::algorithm::join(rows[0], ", ");
+    sql_ss << boost::algorithm::join(columns, ", ");
     sql_ss << ") VALUES (";
     sql_ss << boost::algorithm::join(
-        std::vector<std::string>(rows[0].size(), "?"), ", ");
+        std::vector<std::string>(columns.size(), "?"), ", ");
     sql_ss << ");";
     auto sql = sql_ss.str();
 
-    SQLite::Transaction transaction(*pdb);
-    SQLite::Statement query(*pdb, sql);
+    SQLite::Transaction transaction(db->conn);
+    auto query = db->stmts.get(sql);
 
-    for (int i = 1; i < rows.size(); i++) {
-      for (int j = 0; j < rows[i].size(); j++)
-        query.bind(j + 1, rows[i][j]);
-
-      query.executeStep();
-      query.reset();
+    try {
+      for (auto &&row : rows) {
+        bind_params(*query, row);
+        query->executeStep();
+        query->reset();
+      }
+    } catch (...) {
+      query->reset();
+      throw;
     }
     transaction.commit();
 
     return 0;
   }
 
+  static void
+  prune_read_sites(BasicNode *root,
+                   const std::vector<std::vector<std::string>> &pruned) {
+    for (auto &&table_sites : pruned)
+      pruneReadSites(root, table_sites[0],
+                     {table_sites.begin() + 1, table_sites.end()});
+  }
+
   seastar::future<std::vector<std::vector<std::string>>>
-  rpc_exec_query_node(std::string sql, int nodenum) {
-    std::cout << "rpc exec query node " << sql << ' ' << nodenum << std::endl;
-    return seastar::async([this, sql, nodenum]() {
-      auto result = parseSelectStmt(sql, pdb_meta);
-      auto node = buildRawNodeTreeFromSelectStmt(result, pdb_meta);
-      pushDownAndOptimize(node.get(), {}, {}, "", pdb_meta);
+  rpc_exec_query_node(DbContext *db, PlanSource src, int nodenum) {
+    std::cout << "rpc exec query node " << src.sql << ' ' << nodenum
+              << std::endl;
+    return seastar::make_ready_future<>().then([this, db, src, nodenum]() {
+      auto result = parseSelectStmt(src.sql, &db->meta);
+      auto node = buildRawNodeTreeFromSelectStmt(result, &db->meta);
+      pushDownAndOptimize(node.get(), {}, {}, "", &db->meta);
+      prune_read_sites(node.get(), src.pruned);
       std::vector<std::shared_ptr<BasicNode>> nodes;
-      auto copy = node->copy(pdb_meta, nodes);
+      auto copy = node->copy(&db->meta, nodes);
 
       // for (auto node : nodes) {
       //   auto ptr = node.get();
@@ -223,14 +618,36 @@ public:
       // }
       // std::cout << std::endl;
 
+      if (nodenum < 0 || nodenum >= (int)nodes.size())
+        throw std::runtime_error("plan of the coordinator has no node " +
+                                 std::to_string(nodenum));
       std::cout << nodes[nodenum]->to_string() << std::endl;
-
-      return exec_query_node(nodes[nodenum].get(), sql).get();
+      return exec_plan(db, nodes[nodenum], std::move(nodes), src);
     });
   }
 
+  // run the plan rooted at root. nodes holds every node of the plan, which
+  // has to stay alive until the result is ready
   seastar::future<std::vector<std::vector<std::string>>>
-  exec_query_node(BasicNode *node, std::string sql) {
+  exec_plan(DbContext *db, std::shared_ptr<BasicNode> root,
+            std::vector<std::shared_ptr<BasicNode>> nodes, PlanSource src) {
+    return seastar::make_ready_future<>()
+        .then([this, db, root, src]() {
+          prefetch_read_tables(db, root.get());
+          return exec_query_node(db, root.get(), src);
+        })
+        .then_wrapped([this, db, root,
+                       nodes = std::move(nodes)](auto fut) mutable {
+          if (fut.failed())
+            drop_prefetched_reads(nodes);
+          return fut;
+        });
+  }
+
+  // every node continues on its children's futures, so a query never holds
+  // a thread or blocks while its fragments are read
+  seastar::future<std::vector<std::vector<std::string>>>
+  exec_query_node(DbContext *db, BasicNode *node, const PlanSource &src) {
     if (node->disabled) {
       if (auto projection = dynamic_cast<ProjectionNode *>(node)) {
         return seastar::make_ready_future<
@@ -243,295 +660,1459 @@ public:
 
     if (node->exec_on_site.size() && node->exec_on_site != config.name &&
         (dynamic_cast<NJoinNode *>(node) || dynamic_cast<UnionNode *>(node))) {
-      return rpc_remotenode(*pclients[node->exec_on_site], sql,
-                            node->array_index);
+      return rpc_remotenode(*pclients[node->exec_on_site], db->name, src.sql,
+                            src.pruned, node->array_index);
     }
 
     if (auto projection = dynamic_cast<ProjectionNode *>(node)) {
-      auto result = exec_query_node(projection->child.get(), sql).get();
-      std::vector<std::vector<std::string>> new_result;
-      std::vector<int> keep_columns;
-
-      for (int i = 0; i < result[0].size(); i++) {
-        if (std::find(projection->column_names.begin(),
-                      projection->column_names.end(),
-                      result[0][i]) != projection->column_names.end())
-          keep_columns.push_back(i);
-      }
-
-      for (auto &&row : result) {
-        new_result.emplace_back();
-        auto &val = new_result.back();
-        for (auto i : keep_columns) {
-          val.emplace_back(std::move(row[i]));
-        }
-      }
+      return exec_query_node(db, projection->child.get(), src)
+          .then([projection](auto result) {
+            std::vector<std::vector<std::string>> new_result;
+            std::vector<int> keep_columns;
+
+            for (int i = 0; i < result[0].size(); i++) {
+              if (std::find(projection->column_names.begin(),
+                            projection->column_names.end(),
+                            result[0][i]) != projection->column_names.end())
+                keep_columns.push_back(i);
+            }
 
-      // for (auto &&row : new_result) {
-      //   std::cout << boost::algorithm::join(row, ", ") << std::endl;
-      // }
+            for (auto &&row : result) {
+              new_result.emplace_back();
+              auto &val = new_result.back();
+              for (auto i : keep_columns) {
+                val.emplace_back(std::move(row[i]));
+              }
+            }
 
-      node->result = new_result.size() - 1;
+            projection->result = new_result.size() - 1;
 
-      return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
-          new_result);
+            return new_result;
+          });
     } else if (auto njoin = dynamic_cast<NJoinNode *>(node)) {
       std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
 
       for (auto ch : njoin->join_children) {
-        futs.emplace_back(std::move(exec_query_node(ch.get(), sql)));
+        futs.emplace_back(std::move(exec_query_node(db, ch.get(), src)));
       }
 
-      auto child_result_futs =
-          seastar::when_all(futs.begin(), futs.end()).get();
+      return seastar::when_all_succeed(futs.begin(), futs.end())
+          .then([njoin](auto child_results) {
+            std::vector<std::vector<std::string>> result;
+            std::vector<std::multimap<std::string, std::vector<std::string>>>
+                sorted_results;
+            std::set<std::string> visited_keys;
+            std::set<std::string> join_colnames(
+                njoin->join_column_names.begin(),
+                njoin->join_column_names.end());
+
+            result.emplace_back();
+            result.back().push_back(njoin->join_column_names.front());
+
+            for (auto &&child_result : child_results) {
+              sorted_results.emplace_back();
+
+              auto &&child_cols = child_result[0];
+
+              int join_ind = 0;
+
+              for (int i = 0; i < child_cols.size(); i++) {
+                if (join_colnames.count(child_cols[i]) != 0) {
+                  join_ind = i;
+                } else {
+                  result.back().push_back(child_cols[i]);
+                }
+              }
+
+              for (int i = 1; i < child_result.size(); i++) {
+                std::vector<std::string> row;
+                for (int j = 0; j < child_result[i].size(); j++) {
+                  if (j != join_ind)
+                    row.push_back(child_result[i][j]);
+                }
+                sorted_results.back().insert({child_result[i][join_ind], row});
+              }
+            }
 
-      std::vector<std::vector<std::string>> result;
-      std::vector<std::multimap<std::string, std::vector<std::string>>>
-          sorted_results;
-      std::set<std::string> visited_keys;
-      std::set<std::string> join_colnames(njoin->join_column_names.begin(),
-                                          njoin->join_column_names.end());
+            for (auto &&[val, rem] : sorted_results[0]) {
 
-      result.emplace_back();
-      result.back().push_back(njoin->join_column_names.front());
+              if (visited_keys.count(val))
+                continue;
 
-      for (auto &&r : child_result_futs) {
-        sorted_results.emplace_back();
+              visited_keys.insert(val);
 
-        auto &&child_result = r.get();
-        auto &&child_cols = child_result[0];
+              bool have = true;
+              for (int i = 1; i < sorted_results.size(); i++) {
+                if (sorted_results[i].count(val) == 0) {
+                  have = false;
+                  break;
+                }
+              }
 
-        int join_ind = 0;
+              if (!have)
+                continue;
 
-        for (int i = 0; i < child_cols.size(); i++) {
-          if (join_colnames.count(child_cols[i]) != 0) {
-            join_ind = i;
-          } else {
-            result.back().push_back(child_cols[i]);
-          }
-        }
+              auto nresult = dfs_join(val, sorted_results);
+              std::move(nresult.begin(), nresult.end(),
+                        std::back_inserter(result));
+            }
 
-        for (int i = 1; i < child_result.size(); i++) {
-          std::vector<std::string> row;
-          for (int j = 0; j < child_result[i].size(); j++) {
-            if (j != join_ind)
-              row.push_back(child_result[i][j]);
-          }
-          sorted_results.back().insert({child_result[i][join_ind], row});
-        }
-      }
+            if (njoin->change_all_table_name) {
+              for (auto &name : result[0]) {
+                auto [c0, c1] = split_column_name(name);
+                name = format_column_name(*njoin->change_all_table_name, c1);
+              }
+            }
 
-      for (auto &&[val, rem] : sorted_results[0]) {
+            njoin->result = result.size() - 1;
 
-        if (visited_keys.count(val))
-          continue;
+            return result;
+          });
+    } else if (auto union_ = dynamic_cast<UnionNode *>(node)) {
+      std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
 
-        visited_keys.insert(val);
+      for (auto child : union_->union_children)
+        futs.emplace_back(std::move(exec_query_node(db, child.get(), src)));
 
-        bool have = true;
-        for (int i = 1; i < sorted_results.size(); i++) {
-          if (sorted_results[i].count(val) == 0) {
-            have = false;
-            break;
-          }
-        }
+      return seastar::when_all_succeed(futs.begin(), futs.end())
+          .then([union_](auto child_results) {
+            auto result = std::move(child_results[0]);
 
-        if (!have)
-          continue;
+            for (int i = 1; i < child_results.size(); i++) {
+              auto &&result1 = child_results[i];
+              std::move(result1.begin() + 1, result1.end(),
+                        std::back_inserter(result));
+            }
 
-        auto nresult = dfs_join(val, sorted_results);
-        std::move(nresult.begin(), nresult.end(), std::back_inserter(result));
-      }
+            if (union_->change_all_table_name) {
+              for (auto &name : result[0]) {
+                auto [c0, c1] = split_column_name(name);
+                name = format_column_name(*union_->change_all_table_name, c1);
+              }
+            }
 
-      if (njoin->change_all_table_name) {
-        for (auto &name : result[0]) {
-          auto [c0, c1] = split_column_name(name);
-          name = format_column_name(*njoin->change_all_table_name, c1);
-        }
-      }
+            union_->result = result.size() - 1;
 
-      // for (auto &&row : result) {
-      //   std::cout << boost::algorithm::join(row, ", ") << std::endl;
-      // }
+            return result;
+          });
+    } else if (auto rename = dynamic_cast<RenameNode *>(node)) {
+      return exec_query_node(db, rename->child.get(), src)
+          .then([rename](auto result) {
+            for (int i = 0; i < result[0].size(); i++)
+              result[0][i] = format_column_name(
+                  rename->table_name,
+                  std::get<1>(split_column_name(result[0][i])));
 
-      node->result = result.size() - 1;
+            rename->result = result.size() - 1;
 
-      return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
-          result);
-    } else if (auto union_ = dynamic_cast<UnionNode *>(node)) {
-      std::vector<std::vector<std::string>> result;
-      std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
+            return result;
+          });
+    } else if (auto readtable = dynamic_cast<ReadTableNode *>(node)) {
+      auto [site, tablename] = split_column_name(readtable->table_name);
 
-      for (auto child : union_->union_children)
-        futs.emplace_back(std::move(exec_query_node(child.get(), sql)));
+      seastar::future<std::vector<std::vector<std::string>>> fut =
+          seastar::make_ready_future<std::vector<std::vector<std::string>>>();
+      auto prefetched = prefetched_reads.find(node);
+      if (prefetched != prefetched_reads.end()) {
+        fut = std::move(prefetched->second);
+        prefetched_reads.erase(prefetched);
+      } else {
+        std::vector<std::variant<int64_t, std::string>> params;
+        auto read_sql = build_read_table_sql(db, readtable, params);
+        fut = site_exec_sql(db, site, read_sql, params);
+      }
 
-      auto child_result_futs =
-          seastar::when_all(futs.begin(), futs.end()).get();
+      return fut.then([readtable, tablename = tablename](auto result) {
+        for (int i = 0; i < readtable->column_names.size(); i++)
+          result[0][i] = format_column_name(
+              tablename,
+              std::get<1>(split_column_name(readtable->column_names[i])));
 
-      result = child_result_futs[0].get();
+        readtable->result = result.size() - 1;
 
-      for (int i = 1; i < child_result_futs.size(); i++) {
-        auto result1 = child_result_futs[i].get();
-        std::move(result1.begin() + 1, result1.end(),
-                  std::back_inserter(result));
+        return result;
+      });
+    }
+
+    return seastar::make_ready_future<std::vector<std::vector<std::string>>>();
+  }
+
+  // the global key index of a table is spread over the sites by key. the
+  // owner of a key keeps it in gidx_<table> with the comma separated sites
+  // whose fragments hold the row
+  std::string gidx_owner(const std::variant<int64_t, std::string> &key) {
+    uint64_t h;
+    if (key.index() == 0) {
+      h = std::get<0>(key);
+    } else {
+      // fnv-1a, so every site picks the same owner
+      h = 14695981039346656037ull;
+      for (unsigned char c : std::get<1>(key)) {
+        h ^= c;
+        h *= 1099511628211ull;
       }
+    }
+    return sites[h % sites.size()];
+  }
 
-      if (union_->change_all_table_name) {
-        for (auto &name : result[0]) {
-          auto [c0, c1] = split_column_name(name);
-          name = format_column_name(*union_->change_all_table_name, c1);
-        }
+  // an empty row_sites removes the keys
+  int local_gidx_update(DbContext *db, std::string table,
+                        std::vector<std::variant<int64_t, std::string>> keys,
+                        std::string row_sites) {
+    auto query = db->stmts.get(
+        row_sites.empty() ? "delete from gidx_" + table + " where k = ?"
+                          : "insert or replace into gidx_" + table +
+                                " values (?, ?)");
+
+    SQLite::Transaction transaction(db->conn);
+    try {
+      for (auto &&key : keys) {
+        bind_params(*query, {key});
+        if (row_sites.size())
+          query->bind(2, row_sites);
+        query->exec();
+        query->reset();
       }
+    } catch (...) {
+      query->reset();
+      throw;
+    }
+    transaction.commit();
 
-      node->result = result.size() - 1;
+    return 0;
+  }
 
-      return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
-          result);
+  std::string local_gidx_lookup(DbContext *db, std::string table,
+                                std::variant<int64_t, std::string> key) {
+    auto rows =
+        local_exec_sql(db, "select sites from gidx_" + table + " where k = ?;",
+                       {key});
+    return rows.size() > 1 ? rows[1][0] : "";
+  }
 
-    } else if (auto rename = dynamic_cast<RenameNode *>(node)) {
-      auto result = exec_query_node(rename->child.get(), sql).get();
+  seastar::future<int>
+  site_gidx_update(DbContext *db, std::string site, std::string table,
+                   std::vector<std::variant<int64_t, std::string>> keys,
+                   std::string row_sites) {
+    if (site == config.name)
+      return seastar::make_ready_future<>().then(
+          [this, db, table, keys = std::move(keys), row_sites]() {
+            return local_gidx_update(db, table, keys, row_sites);
+          });
 
-      for (int i = 0; i < result[0].size(); i++)
-        result[0][i] = format_column_name(
-            rename->table_name, std::get<1>(split_column_name(result[0][i])));
+    return rpc_gidx_update(*pclients[site], db->name, table, keys, row_sites);
+  }
 
-      node->result = result.size() - 1;
+  seastar::future<std::string>
+  site_gidx_lookup(DbContext *db, std::string table,
+                   std::variant<int64_t, std::string> key) {
+    auto site = gidx_owner(key);
+    if (site == config.name)
+      return seastar::make_ready_future<>().then([this, db, table, key]() {
+        return local_gidx_lookup(db, table, key);
+      });
+
+    return rpc_gidx_lookup(*pclients[site], db->name, table, key);
+  }
 
-      return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
-          result);
+  // point the keys at row_sites, or drop them when it is empty
+  seastar::future<>
+  gidx_update(DbContext *db, std::string table,
+              std::vector<std::variant<int64_t, std::string>> keys,
+              std::string row_sites) {
+    std::map<std::string, std::vector<std::variant<int64_t, std::string>>>
+        owned;
+    for (auto &&key : keys)
+      owned[gidx_owner(key)].push_back(key);
+
+    std::vector<seastar::future<int>> futs;
+    for (auto &&[owner, owner_keys] : owned)
+      futs.emplace_back(
+          site_gidx_update(db, owner, table, std::move(owner_keys), row_sites));
+
+    return seastar::when_all_succeed(futs.begin(), futs.end())
+        .discard_result();
+  }
 
-    } else if (auto readtable = dynamic_cast<ReadTableNode *>(node)) {
-      auto [site, tablename] = split_column_name(readtable->table_name);
-      auto &&table_meta = pdb_meta->tables[readtable->orig_table_name];
-
-      std::stringstream sql_ss;
-      sql_ss << "select "
-             << boost::algorithm::join(readtable->column_names, ", ")
-             << " from " << tablename << " where true";
-
-      for (auto cond : readtable->select_conds) {
-        if (table_meta.frag_type == table_meta.VFRAG) {
-          auto &&cols = std::get<1>(table_meta.vfrag_cols[site]);
-          if (std::find(cols.begin(), cols.end(),
-                        std::get<1>(split_column_name(cond.val1))) ==
-              cols.end())
-            continue;
-        }
+  // typed values of the first column of a fragment result
+  static void append_result_keys(
+      TableMetadata &table_info, const std::string &column,
+      const std::vector<std::vector<std::string>> &rows,
+      std::vector<std::variant<int64_t, std::string>> &keys) {
+    bool int_key = table_info.column_type[column] == "int";
+
+    // the first row holds the column names
+    for (size_t i = 1; i < rows.size(); i++) {
+      if (int_key)
+        keys.push_back((int64_t)std::stoll(rows[i][0]));
+      else
+        keys.push_back(rows[i][0]);
+    }
+  }
 
-        sql_ss << " and " << cond.val1 << " " << cond.op << " ";
-        if (cond.val2.index() == 0)
-          sql_ss << std::get<0>(cond.val2);
-        else
-          sql_ss << "'" << std::get<1>(cond.val2) << "'";
+  // table, key position and index value of the rows an insert into a
+  // fragment adds to a global index. of a vertically fragmented table only
+  // the first fragment reports its keys
+  struct GidxTarget {
+    std::string table;
+    size_t key_pos;
+    std::string row_sites;
+  };
+
+  std::optional<GidxTarget> gidx_target(DbContext *db, const std::string &site,
+                                        const InsertStmt &stmt) {
+    for (auto &&[tname, tmeta] : db->meta.tables) {
+      if (tmeta.pk_index.empty())
+        continue;
+
+      size_t pos = std::find(stmt.columns.begin(), stmt.columns.end(),
+                             tmeta.pk_index) -
+                   stmt.columns.begin();
+      if (pos == stmt.columns.size())
+        continue;
+
+      if (tmeta.frag_type == TableMetadata::HFRAG) {
+        auto it = tmeta.hfrag_conds.find(site);
+        if (it != tmeta.hfrag_conds.end() &&
+            std::get<0>(it->second) == stmt.table_name)
+          return GidxTarget{tname, pos, site};
+      } else if (tmeta.vfrag_cols.size()) {
+        auto &&[first_site, first_frag] = *tmeta.vfrag_cols.begin();
+        if (first_site != site || std::get<0>(first_frag) != stmt.table_name)
+          continue;
+
+        std::vector<std::string> row_sites;
+        for (auto &&[sname, sdata] : tmeta.vfrag_cols)
+          row_sites.push_back(sname);
+        return GidxTarget{tname, pos, boost::algorithm::join(row_sites, ",")};
       }
-      sql_ss << ";";
+    }
 
-      auto result = rpc_sql_exec(*pclients[site], sql_ss.str()).get();
-      for (int i = 0; i < readtable->column_names.size(); i++)
-        result[0][i] = format_column_name(
-            tablename,
-            std::get<1>(split_column_name(readtable->column_names[i])));
+    return {};
+  }
 
-      // for (auto &&row : result) {
-      //   std::cout << boost::algorithm::join(row, ", ") << std::endl;
-      // }
+  // createpkindex <table> <col>: every site records the index and creates
+  // its share of it, then the keys already stored are indexed
+  seastar::future<std::vector<std::vector<std::string>>>
+  create_pk_index(DbContext *db, std::string sql) {
+    std::vector<seastar::future<int>> futs_int;
+    for (auto sname : sites) {
+      futs_int.emplace_back(std::move(
+          rpc_control(*pclients[sname], db->name, sql, "createpkindex")));
+    }
 
-      node->result = result.size() - 1;
+    return seastar::when_all_succeed(futs_int.begin(), futs_int.end())
+        .then([this, db, sql](auto) {
+          return seastar::async([this, db, sql]() {
+            auto table = parseCreatePkIndex(sql, &db->meta, nullptr);
+            auto &&table_info = db->meta.tables[table];
+            auto &&pk = table_info.pk_index;
+            size_t indexed = 0;
+
+            std::map<std::string, std::string> frags;
+            for (auto &&[sname, sdata] : table_info.hfrag_conds)
+              frags[sname] = std::get<0>(sdata);
+            if (table_info.vfrag_cols.size()) {
+              auto &&[sname, sdata] = *table_info.vfrag_cols.begin();
+              frags[sname] = std::get<0>(sdata);
+            }
 
-      return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
-          result);
+            for (auto &&[sname, fname] : frags) {
+              std::vector<std::variant<int64_t, std::string>> keys;
+              append_result_keys(table_info, pk,
+                                 site_exec_sql(db, sname,
+                                               "select " + pk + " from " +
+                                                   fname + ";")
+                                     .get(),
+                                 keys);
+
+              InsertStmt stmt{fname, {pk}, {}};
+              auto target = gidx_target(db, sname, stmt);
+              indexed += keys.size();
+              gidx_update(db, table, std::move(keys), target->row_sites).get();
+            }
+
+            return std::vector<std::vector<std::string>>{
+                {fmt::format("indexed {} keys", indexed)}};
+          });
+        });
+  }
+
+  // fragment and row count of the rows sent to each site
+  using InsertCounts = std::map<std::string, std::tuple<std::string, size_t>>;
+
+  static void count_inserts(InsertCounts &counts,
+                            const std::map<std::string, InsertStmt> &istmt) {
+    for (auto &&[sname, stmt] : istmt) {
+      auto &count = counts[sname];
+      std::get<0>(count) = stmt.table_name;
+      std::get<1>(count) += stmt.values.size();
     }
   }
 
+  static std::string insert_summary(const InsertCounts &counts) {
+    std::stringstream ss;
+    size_t total = 0;
+    for (auto &&[sname, count] : counts) {
+      ss << sname << " " << std::get<0>(count) << " " << std::get<1>(count)
+         << "\n";
+      total += std::get<1>(count);
+    }
+    ss << "TOTAL " << total << "\n";
+    return ss.str();
+  }
+
+  static std::string
+  insert_summary(const std::map<std::string, InsertStmt> &istmt) {
+    InsertCounts counts;
+    count_inserts(counts, istmt);
+    return insert_summary(counts);
+  }
+
   seastar::future<std::string>
-  exec_insert_sites(std::map<std::string, InsertStmt> istmt) {
-    std::vector<seastar::future<int>> futures;
+  exec_insert_sites(DbContext *db, std::map<std::string, InsertStmt> istmt) {
+    auto msg = insert_summary(istmt);
+
+    return seastar::do_with(std::move(istmt),
+                            [this, db](auto &istmt) {
+                              return seastar::parallel_for_each(
+                                  istmt, [this, db](auto &site_stmt) {
+                                    return insert_site_batches(
+                                        db, site_stmt.first, site_stmt.second);
+                                  });
+                            })
+        .then([msg]() { return msg; });
+  }
+
+  seastar::future<int>
+  site_insert(
+      DbContext *db, std::string site, std::string table_name,
+      std::vector<std::string> columns,
+      std::vector<std::vector<std::variant<int64_t, std::string>>> rows) {
+    if (site == config.name)
+      return seastar::make_ready_future<>().then(
+          [this, db, table_name, columns, rows = std::move(rows)]() mutable {
+            return local_insert(db, table_name, columns, std::move(rows));
+          });
+
+    return rpc_insert_exec(*pclients[site], db->name, table_name, columns,
+                           rows);
+  }
+
+  seastar::future<std::string>
+  buffer_insert_sites(DbContext *db, std::map<std::string, InsertStmt> istmt) {
+    auto msg = insert_summary(istmt);
+    std::vector<seastar::future<>> futs;
 
     for (auto &&[sname, stmt] : istmt) {
-      std::vector<std::vector<std::string>> values;
+      InsertGroupKey key{db->name, sname, stmt.table_name, stmt.columns};
+      auto &group = insert_groups[key];
+
+      if (!group) {
+        group = std::make_unique<InsertGroup>();
+        group->stmt.table_name = stmt.table_name;
+        group->stmt.columns = stmt.columns;
+        group->flush_timer.set_callback(
+            [this, key]() { (void)flush_insert_group(key); });
+        group->flush_timer.arm(
+            std::chrono::milliseconds(config.insert_buffer_ms));
+      }
 
-      values.push_back(stmt.columns);
+      std::move(stmt.values.begin(), stmt.values.end(),
+                std::back_inserter(group->stmt.values));
+      futs.emplace_back(group->committed.get_shared_future());
+
+      if (group->stmt.values.size() >= config.insert_buffer_rows)
+        (void)flush_insert_group(key);
+    }
 
-      for (auto &&data : stmt.values) {
-        std::vector<std::string> row;
-        for (auto val : data) {
-          if (val.index() == 0)
-            row.push_back(std::to_string(std::get<0>(val)));
+    return seastar::when_all_succeed(futs.begin(), futs.end())
+        .then([msg]() { return msg; });
+  }
+
+  seastar::future<> flush_insert_group(InsertGroupKey key) {
+    auto it = insert_groups.find(key);
+    if (it == insert_groups.end())
+      return seastar::make_ready_future<>();
+
+    auto group = std::move(it->second);
+    insert_groups.erase(it);
+    group->flush_timer.cancel();
+
+    // the whole group is one transaction, so its inserts commit or fail
+    // together and a failure never acknowledges stored rows as lost
+    auto db = db_context(std::get<0>(key));
+    auto &&site = std::get<1>(key);
+    auto &stmt = group->stmt;
+    return send_insert_batch(db, site, stmt, gidx_target(db, site, stmt),
+                             std::move(stmt.values))
+        .then_wrapped([group = std::move(group)](auto fut) mutable {
+          if (fut.failed())
+            group->committed.set_exception(fut.get_exception());
           else
-            row.push_back(std::get<1>(val));
-        }
-        values.push_back(row);
+            group->committed.set_value();
+        });
+  }
+
+  // stmt must stay alive until the returned future resolves
+  seastar::future<> insert_site_batches(DbContext *db, std::string site,
+                                        InsertStmt &stmt) {
+    size_t nbatches =
+        (stmt.values.size() + insert_batch_rows - 1) / insert_batch_rows;
+    auto gidx = gidx_target(db, site, stmt);
+
+    return seastar::do_with(
+        seastar::semaphore(insert_batch_credits),
+        [this, db, site, &stmt, nbatches, gidx](auto &credits) {
+          return seastar::parallel_for_each(
+              boost::irange<size_t>(0, nbatches),
+              [this, db, site, &stmt, &credits, gidx](size_t batch) {
+                return seastar::with_semaphore(
+                    credits, 1, [this, db, site, &stmt, batch, gidx]() {
+                      auto begin = batch * insert_batch_rows;
+                      auto end = std::min(stmt.values.size(),
+                                          begin + insert_batch_rows);
+
+                      // every batch is sent once, its rows can be moved out
+                      decltype(stmt.values) values(
+                          std::make_move_iterator(stmt.values.begin() + begin),
+                          std::make_move_iterator(stmt.values.begin() + end));
+
+                      return send_insert_batch(db, site, stmt, gidx,
+                                               std::move(values));
+                    });
+              });
+        });
+  }
+
+  // commit one batch of stmt's fragment on site and index its keys
+  seastar::future<>
+  send_insert_batch(DbContext *db, std::string site, const InsertStmt &stmt,
+                    std::optional<GidxTarget> gidx,
+                    std::vector<std::vector<std::variant<int64_t, std::string>>>
+                        values) {
+    std::vector<std::variant<int64_t, std::string>> keys;
+    if (gidx)
+      for (auto &&row : values)
+        keys.push_back(row[gidx->key_pos]);
+
+    return site_insert(db, site, stmt.table_name, stmt.columns,
+                       std::move(values))
+        .then([this, db, gidx, keys = std::move(keys)](int) {
+          if (!gidx)
+            return seastar::make_ready_future<>();
+          return gidx_update(db, gidx->table, keys, gidx->row_sites);
+        });
+  }
+
+  // state of an import that is being sent. a site's credits are shared by
+  // all chunks, so the next chunk is parsed as soon as the batches of the
+  // last one are in flight rather than once they are committed
+  struct ImportState {
+    std::unique_ptr<TSVChunkReader> reader;
+    InsertCounts totals;
+    std::map<std::string, seastar::semaphore> credits;
+    seastar::gate sending;
+    std::exception_ptr error;
+  };
+
+  // chunks are parsed on the reactor one at a time, with a yield between
+  // them, and cut into batches of insert_batch_rows. a site has at most
+  // insert_batch_credits batches in flight and parsing waits for a free
+  // credit, so the rows held are about one chunk and the batches in flight
+  // however large the file is
+  seastar::future<std::string>
+  import_chunks(DbContext *db, std::unique_ptr<TSVChunkReader> reader) {
+    auto state = std::make_unique<ImportState>();
+    state->reader = std::move(reader);
+
+    return seastar::do_with(std::move(state), [this, db](auto &state) {
+      auto &st = *state;
+      return seastar::repeat([this, db, &st] {
+               auto chunk = st.error ? std::nullopt : st.reader->next();
+               if (!chunk)
+                 return seastar::make_ready_future<seastar::stop_iteration>(
+                     seastar::stop_iteration::yes);
+
+               count_inserts(st.totals, *chunk);
+               return seastar::do_with(
+                          std::move(*chunk),
+                          [this, db, &st](auto &sites) {
+                            return seastar::parallel_for_each(
+                                sites, [this, db, &st](auto &site_stmt) {
+                                  return queue_site_batches(
+                                      db, st, site_stmt.first,
+                                      site_stmt.second);
+                                });
+                          })
+                   .then([] { return seastar::stop_iteration::no; });
+             })
+          .finally([&st] { return st.sending.close(); })
+          .then([&st] {
+            if (st.error)
+              std::rethrow_exception(st.error);
+            return insert_summary(st.totals);
+          });
+    });
+  }
+
+  // hand every batch of stmt to the background once it has a credit of
+  // site. the future resolves when the last batch is handed off
+  seastar::future<> queue_site_batches(DbContext *db, ImportState &st,
+                                       const std::string &site,
+                                       InsertStmt &stmt) {
+    auto &credits =
+        st.credits.try_emplace(site, insert_batch_credits).first->second;
+    size_t nbatches =
+        (stmt.values.size() + insert_batch_rows - 1) / insert_batch_rows;
+    auto gidx = gidx_target(db, site, stmt);
+
+    auto batches = boost::irange<size_t>(0, nbatches);
+    return seastar::do_for_each(
+        batches.begin(), batches.end(),
+        [this, db, &st, &credits, site, &stmt, gidx](size_t batch) {
+          return seastar::get_units(credits, 1).then(
+              [this, db, &st, site, &stmt, gidx, batch](auto units) {
+                auto begin = batch * insert_batch_rows;
+                auto end =
+                    std::min(stmt.values.size(), begin + insert_batch_rows);
+                decltype(stmt.values) values(
+                    std::make_move_iterator(stmt.values.begin() + begin),
+                    std::make_move_iterator(stmt.values.begin() + end));
+
+                // send_insert_batch copies the names it needs before the
+                // chunk is gone
+                (void)seastar::with_gate(
+                    st.sending, [this, db, &st, site, &stmt, gidx,
+                                 values = std::move(values),
+                                 units = std::move(units)]() mutable {
+                      return send_insert_batch(db, site, stmt, gidx,
+                                               std::move(values))
+                          .handle_exception([&st](std::exception_ptr ep) {
+                            if (!st.error)
+                              st.error = ep;
+                          })
+                          .finally([units = std::move(units)] {});
+                    });
+              });
+        });
+  }
+
+  seastar::future<std::string>
+  insert_from_file(DbContext *db, std::string table, std::string filename) {
+    return seastar::make_ready_future<>().then([this, db, table, filename] {
+      return import_chunks(db, std::make_unique<TSVChunkReader>(
+                                   table, filename, &db->meta));
+    });
+  }
+
+  // import the lines starting in [begin, end) of a file every site can read,
+  // routing them from this site
+  seastar::future<std::string> import_file_range(DbContext *db,
+                                                 std::string table,
+                                                 std::string filename,
+                                                 uint64_t begin, uint64_t end) {
+    return seastar::make_ready_future<>().then(
+        [this, db, table, filename, begin, end] {
+          return import_chunks(db, std::make_unique<TSVChunkReader>(
+                                       table, filename, &db->meta, begin,
+                                       end));
+        });
+  }
+
+  seastar::future<std::string> site_import_range(DbContext *db,
+                                                 std::string site,
+                                                 std::string table,
+                                                 std::string filename,
+                                                 uint64_t begin, uint64_t end) {
+    if (site == config.name)
+      return import_file_range(db, table, filename, begin, end);
+
+    return rpc_import_range(*pclients[site], db->name, table, filename, begin,
+                            end);
+  }
+
+  // every site scans its own share of the file, so the coordinator does not
+  // parse and route the whole import alone
+  seastar::future<std::string> insert_from_shared_file(DbContext *db,
+                                                       std::string table,
+                                                       std::string filename) {
+    uint64_t size = std::filesystem::file_size(filename);
+    std::vector<seastar::future<std::string>> futs;
+
+    for (int i = 0; i < sites.size(); i++) {
+      futs.emplace_back(site_import_range(db, sites[i], table, filename,
+                                          size * i / sites.size(),
+                                          size * (i + 1) / sites.size()));
+    }
+
+    return seastar::when_all(futs.begin(), futs.end())
+        .then([this, db](auto futs) {
+          std::stringstream ss;
+          for (int i = 0; i < futs.size(); i++)
+            ss << "FROM " << sites[i] << "\n" << futs[i].get();
+          return ss.str();
+        });
+  }
+
+  std::vector<std::string> local_fragments(DbContext *db, std::string table) {
+    std::vector<std::string> frags;
+    auto &&table_meta = db->meta.tables[table];
+
+    if (table_meta.frag_type == TableMetadata::HFRAG) {
+      if (table_meta.hfrag_conds.count(config.name))
+        frags.push_back(std::get<0>(table_meta.hfrag_conds[config.name]));
+    } else {
+      if (table_meta.vfrag_cols.count(config.name))
+        frags.push_back(std::get<0>(table_meta.vfrag_cols[config.name]));
+    }
+
+    return frags;
+  }
+
+  static constexpr const char *deferred_indexes_table =
+      "create table if not exists deferred_indexes (frag text, sql text)";
+
+  // re-creates the indexes dropped for loading frag, or for every fragment
+  // when frag is empty
+  static void restore_deferred_indexes(SQLite::Database &conn,
+                                       const std::string &frag) {
+    std::vector<std::string> indexes;
+    SQLite::Statement query(
+        conn, "select sql from deferred_indexes where ? = '' or frag = ?");
+    query.bind(1, frag);
+    query.bind(2, frag);
+    while (query.executeStep())
+      indexes.push_back(query.getColumn(0));
+    query.reset();
+
+    SQLite::Transaction transaction(conn);
+    for (auto &&index_sql : indexes)
+      conn.exec(index_sql);
+
+    SQLite::Statement done(
+        conn, "delete from deferred_indexes where ? = '' or frag = ?");
+    done.bind(1, frag);
+    done.bind(2, frag);
+    done.exec();
+    transaction.commit();
+  }
+
+  // no journal sync and a large cache while loading, indexes rebuilt once
+  // at the end
+  void local_bulk_begin(DbContext *db, std::string table) {
+    auto &bulk = db->bulk;
+
+    if (bulk.loads++ == 0) {
+      auto &&conn = db->conn;
+      bulk.journal_mode = conn.execAndGet("PRAGMA journal_mode").getString();
+      bulk.synchronous = conn.execAndGet("PRAGMA synchronous").getInt64();
+      bulk.cache_size = conn.execAndGet("PRAGMA cache_size").getInt64();
+      conn.exec("PRAGMA journal_mode = WAL");
+      conn.exec("PRAGMA synchronous = OFF");
+      conn.exec("PRAGMA cache_size = -262144");
+    }
+
+    // an index is dropped in the transaction that records its sql
+    for (auto frag : local_fragments(db, table)) {
+      std::vector<std::string> names, indexes;
+      SQLite::Statement query(db->conn,
+                              "select name, sql from sqlite_master where "
+                              "type = 'index' and tbl_name = ? and "
+                              "sql is not null");
+      query.bind(1, frag);
+
+      while (query.executeStep()) {
+        names.push_back(query.getColumn(0));
+        indexes.push_back(query.getColumn(1));
       }
+      query.reset();
 
-      futures.emplace_back(std::move(
-          rpc_insert_exec(*pclients[sname], stmt.table_name, values)));
+      SQLite::Transaction transaction(db->conn);
+      SQLite::Statement defer(db->conn,
+                              "insert into deferred_indexes values (?, ?)");
+      for (size_t i = 0; i < names.size(); i++) {
+        defer.bind(1, frag);
+        defer.bind(2, indexes[i]);
+        defer.exec();
+        defer.reset();
+        db->conn.exec("drop index " + names[i]);
+      }
+      transaction.commit();
     }
+  }
 
-    std::stringstream ss;
-    int total = 0;
-    for (auto &&[sname, stmt] : istmt) {
-      ss << sname << " " << stmt.table_name << " " << stmt.values.size()
-         << "\n";
-      total += stmt.values.size();
+  // durability is restored once the last import into the database ends
+  void local_bulk_end(DbContext *db, std::string table) {
+    auto &bulk = db->bulk;
+
+    for (auto frag : local_fragments(db, table))
+      restore_deferred_indexes(db->conn, frag);
+
+    if (bulk.loads > 0 && --bulk.loads == 0) {
+      db->conn.exec("PRAGMA wal_checkpoint(TRUNCATE)");
+      db->conn.exec("PRAGMA journal_mode = " + bulk.journal_mode);
+      db->conn.exec(fmt::format("PRAGMA synchronous = {}", bulk.synchronous));
+      db->conn.exec(fmt::format("PRAGMA cache_size = {}", bulk.cache_size));
     }
-    ss << "TOTAL " << total << "\n";
-    auto msg = ss.str();
+  }
 
-    return seastar::when_all(futures.begin(), futures.end())
-        .then([this, msg](auto futs) {
+  seastar::future<> bulk_load_control(DbContext *db, std::string table,
+                                      std::string type) {
+    std::vector<seastar::future<int>> futs_int;
+    for (auto sname : sites) {
+      futs_int.emplace_back(
+          std::move(rpc_control(*pclients[sname], db->name, table, type)));
+    }
+
+    return seastar::when_all(futs_int.begin(), futs_int.end())
+        .then([](auto futs) {
           for (auto &&fut : futs)
             fut.get();
-          return msg;
         });
   }
 
-  seastar::future<std::string> insert_from_file(std::string table,
-                                                std::string filename) {
-    auto insStmt = insertStmtFromTSV(table, filename, pdb_meta);
-    auto site_ins_stmt = insertStmtToSites(insStmt, pdb_meta);
+  static std::string
+  conds_where_sql(const std::vector<CompareConds> &conds,
+                  std::vector<std::variant<int64_t, std::string>> &params) {
+    std::stringstream sql_ss;
+    sql_ss << " where true";
+    for (auto &&cond : conds) {
+      sql_ss << " and " << cond.val1 << " " << cond.op << " ?";
+      params.push_back(cond.val2);
+    }
+    return sql_ss.str();
+  }
+
+  // the join column values of the vertically fragmented rows matching
+  // conds. each fragment filters on the columns it holds and the key
+  // sets are intersected
+  std::vector<std::variant<int64_t, std::string>>
+  vfrag_matching_keys(DbContext *db, TableMetadata &table_info,
+                      const std::vector<CompareConds> &conds) {
+    auto key = vfragJoinColumn(table_info);
+    bool int_key = table_info.column_type[key] == "int";
+    std::map<std::string, std::vector<CompareConds>> site_conds;
+
+    // a condition no fragment can check would drop out of the key
+    // intersection and widen the statement to more rows
+    for (auto &&cond : conds) {
+      bool held = false;
+      for (auto &&[sname, fraginfo] : table_info.vfrag_cols) {
+        auto &&cols = std::get<1>(fraginfo);
+        held |= std::find(cols.begin(), cols.end(), cond.val1) != cols.end();
+      }
+      if (!held)
+        throw std::runtime_error("no fragment of " + table_info.name +
+                                 " holds column " + cond.val1);
+    }
+
+    for (auto &&[sname, fraginfo] : table_info.vfrag_cols) {
+      auto &&cols = std::get<1>(fraginfo);
+      for (auto &&cond : conds)
+        if (std::find(cols.begin(), cols.end(), cond.val1) != cols.end())
+          site_conds[sname].push_back(cond);
+
+      // one fragment can answer the whole predicate
+      if (site_conds[sname].size() == conds.size()) {
+        site_conds = {{sname, conds}};
+        break;
+      }
+    }
+
+    std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
+    for (auto &&[sname, sconds] : site_conds) {
+      if (sconds.empty())
+        continue;
+      std::vector<std::variant<int64_t, std::string>> params;
+      auto sql = "select " + key + " from " +
+                 std::get<0>(table_info.vfrag_cols[sname]) +
+                 conds_where_sql(sconds, params) + ";";
+      futs.emplace_back(site_exec_sql(db, sname, sql, params));
+    }
+
+    std::optional<std::set<std::string>> keys;
+    for (auto &&fut : futs) {
+      std::set<std::string> frag_keys;
+      auto rows = fut.get();
+      // the first row holds the column names
+      for (size_t i = 1; i < rows.size(); i++)
+        frag_keys.insert(rows[i][0]);
+
+      if (!keys) {
+        keys = std::move(frag_keys);
+      } else {
+        std::set<std::string> common;
+        std::set_intersection(keys->begin(), keys->end(), frag_keys.begin(),
+                              frag_keys.end(),
+                              std::inserter(common, common.begin()));
+        keys = std::move(common);
+      }
+    }
+
+    std::vector<std::variant<int64_t, std::string>> ret;
+    if (keys)
+      for (auto &&k : *keys) {
+        if (int_key)
+          ret.push_back((int64_t)std::stoll(k));
+        else
+          ret.push_back(k);
+      }
+    return ret;
+  }
+
+  static constexpr size_t keys_per_stmt = 500;
+
+  // statement text and its leading parameters, per site
+  using FragSqls = std::map<
+      std::string,
+      std::tuple<std::string, std::vector<std::variant<int64_t, std::string>>>>;
+
+  // run each fragment's statement restricted to the rows whose join
+  // column is in keys, splitting the keys over several statements
+  std::vector<seastar::future<std::vector<std::vector<std::string>>>>
+  vfrag_exec_keys(
+      DbContext *db, TableMetadata &table_info,
+      const std::vector<std::variant<int64_t, std::string>> &keys,
+      FragSqls frag_sqls) {
+    auto key = vfragJoinColumn(table_info);
+    std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
+
+    for (size_t i = 0; i < keys.size(); i += keys_per_stmt) {
+      auto end = std::min(keys.size(), i + keys_per_stmt);
+      std::vector<std::string> marks(end - i, "?");
+      auto in_list = boost::algorithm::join(marks, ", ");
+
+      for (auto &&[sname, frag_sql] : frag_sqls) {
+        auto &&[sql, params] = frag_sql;
+        auto key_params = params;
+        key_params.insert(key_params.end(), keys.begin() + i,
+                          keys.begin() + end);
+        futs.emplace_back(site_exec_sql(
+            db, sname, sql + " where " + key + " in (" + in_list + ");",
+            key_params));
+      }
+    }
+
+    return futs;
+  }
+
+  // run a fragment statement restricted to the given rowids, splitting them
+  // over several statements like vfrag_exec_keys
+  std::vector<seastar::future<std::vector<std::vector<std::string>>>>
+  rowids_exec(DbContext *db, const std::string &site, const std::string &sql,
+              const std::vector<std::variant<int64_t, std::string>> &params,
+              const std::vector<std::variant<int64_t, std::string>> &rowids) {
+    std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
+
+    for (size_t i = 0; i < rowids.size(); i += keys_per_stmt) {
+      auto end = std::min(rowids.size(), i + keys_per_stmt);
+      std::vector<std::string> marks(end - i, "?");
+      auto id_params = params;
+      id_params.insert(id_params.end(), rowids.begin() + i,
+                       rowids.begin() + end);
+      futs.emplace_back(site_exec_sql(
+          db, site,
+          sql + " where rowid in (" + boost::algorithm::join(marks, ", ") +
+              ");",
+          id_params));
+    }
+
+    return futs;
+  }
+
+  // delete the rows matching stmt.conds. horizontal fragments whose
+  // predicate contradicts the conds are skipped, the rest get the
+  // conds pushed into their delete
+  seastar::future<std::vector<std::vector<std::string>>>
+  exec_delete(DbContext *db, DeleteStmt stmt) {
+    return seastar::async([this, db,
+                           stmt]() -> std::vector<std::vector<std::string>> {
+      auto &&table_info = db->meta.tables[stmt.table_name];
+      auto &&pk = table_info.pk_index;
+      std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
+      std::vector<std::tuple<std::string, std::string>> targets;
+      std::vector<std::variant<int64_t, std::string>> removed_keys;
+      int skipped = 0;
+
+      for (auto &&[sname, sdata] : table_info.hfrag_conds) {
+        auto &&[fname, frag_conds] = sdata;
+
+        auto conds = frag_conds;
+        conds.insert(conds.end(), stmt.conds.begin(), stmt.conds.end());
+        if (condsUnsatisfiable(conds)) {
+          skipped++;
+          continue;
+        }
+        targets.emplace_back(sname, fname);
+      }
+
+      // the keys leaving the global index are read before they are gone
+      if (pk.size()) {
+        for (auto &&[sname, fname] : targets) {
+          std::vector<std::variant<int64_t, std::string>> params;
+          auto sql = "select " + pk + " from " + fname +
+                     conds_where_sql(stmt.conds, params) + ";";
+          futs.emplace_back(site_exec_sql(db, sname, sql, params));
+        }
+
+        for (auto &&fut : seastar::when_all(futs.begin(), futs.end()).get())
+          append_result_keys(table_info, pk, fut.get(), removed_keys);
+        futs.clear();
+      }
+
+      for (auto &&[sname, fname] : targets) {
+        std::vector<std::variant<int64_t, std::string>> params;
+        auto sql =
+            "delete from " + fname + conds_where_sql(stmt.conds, params) + ";";
+        futs.emplace_back(site_exec_sql(db, sname, sql, params));
+      }
+
+      if (table_info.vfrag_cols.size()) {
+        if (stmt.conds.empty()) {
+          if (pk.size()) {
+            auto &&[sname, sdata] = *table_info.vfrag_cols.begin();
+            append_result_keys(
+                table_info, pk,
+                site_exec_sql(db, sname, "select " + pk + " from " +
+                                         std::get<0>(sdata) + ";")
+                    .get(),
+                removed_keys);
+          }
+
+          for (auto &&[sname, sdata] : table_info.vfrag_cols)
+            futs.emplace_back(
+                site_exec_sql(db, sname, "delete from " + std::get<0>(sdata)));
+        } else {
+          FragSqls frag_sqls;
+          for (auto &&[sname, sdata] : table_info.vfrag_cols)
+            frag_sqls[sname] = {"delete from " + std::get<0>(sdata), {}};
+
+          auto keys = vfrag_matching_keys(db, table_info, stmt.conds);
+          futs = vfrag_exec_keys(db, table_info, keys, frag_sqls);
+          if (pk.size())
+            removed_keys = std::move(keys);
+        }
+      }
+
+      for (auto &&fut : seastar::when_all(futs.begin(), futs.end()).get())
+        fut.get();
+
+      if (removed_keys.size())
+        gidx_update(db, stmt.table_name, removed_keys, "").get();
+
+      if (skipped)
+        return {{fmt::format("deleted, {} fragments skipped", skipped)}};
+      return {{"deleted"}};
+    });
+  }
+
+  static std::string sets_sql(
+      const std::vector<std::tuple<std::string,
+                                   std::variant<int64_t, std::string>>> &sets,
+      std::vector<std::variant<int64_t, std::string>> &params) {
+    std::vector<std::string> assigns;
+    for (auto &&[col, val] : sets) {
+      assigns.push_back(col + " = ?");
+      params.push_back(val);
+    }
+    return " set " + boost::algorithm::join(assigns, ", ");
+  }
+
+  // update the rows matching stmt.conds. rows are updated in place
+  // unless a horizontal fragmentation column changes; then they are
+  // read out, routed again into their new fragments in batched inserts
+  // and deleted from the old ones
+  seastar::future<std::vector<std::vector<std::string>>>
+  exec_update(DbContext *db, UpdateStmt stmt) {
+    return seastar::async([this, db,
+                           stmt]() -> std::vector<std::vector<std::string>> {
+      auto &&table_info = db->meta.tables[stmt.table_name];
+      std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
+
+      std::set<std::string> frag_cols;
+      for (auto &&[sname, sdata] : table_info.hfrag_conds)
+        for (auto &&cond : std::get<1>(sdata))
+          frag_cols.insert(cond.val1);
+
+      // a new key has to move in the global index as well
+      bool migrate = false;
+      for (auto &&[col, val] : stmt.sets) {
+        migrate = migrate || frag_cols.count(col);
+        if (col == table_info.pk_index) {
+          if (table_info.frag_type == TableMetadata::VFRAG)
+            throw std::runtime_error("indexed key column can not be updated");
+          migrate = true;
+        }
+      }
+
+      std::vector<std::string> read_sites;
+      for (auto &&[sname, sdata] : table_info.hfrag_conds) {
+        auto &&[fname, frag_conds] = sdata;
+
+        auto conds = frag_conds;
+        conds.insert(conds.end(), stmt.conds.begin(), stmt.conds.end());
+        if (condsUnsatisfiable(conds))
+          continue;
+
+        std::vector<std::variant<int64_t, std::string>> params;
+        std::string sql;
+        if (migrate) {
+          // the last column marks the null columns of a row with 1s, as
+          // nulls read back as empty strings
+          std::vector<std::string> nulls;
+          for (auto &&col : table_info.columns)
+            nulls.push_back("(" + col + " is null)");
+          sql = "select rowid, " +
+                boost::algorithm::join(table_info.columns, ", ") + ", " +
+                boost::algorithm::join(nulls, " || ") + " from " + fname;
+          read_sites.push_back(sname);
+        } else {
+          sql = "update " + fname + sets_sql(stmt.sets, params);
+        }
+        sql += conds_where_sql(stmt.conds, params) + ";";
+        futs.emplace_back(site_exec_sql(db, sname, sql, params));
+      }
+
+      auto results = seastar::when_all(futs.begin(), futs.end()).get();
+      futs.clear();
+
+      // rows whose fragment changes are written to their new fragment and
+      // indexed before they leave the old one, so a failed write loses no
+      // row. rows that stay in their fragment are updated in place. moved
+      // rows are inserted without their null columns, grouped by which
+      // columns are null, so the nulls are kept
+      size_t moved_rows = 0;
+      if (migrate) {
+        auto &&pk = table_info.pk_index;
+        std::map<std::string, InsertStmt> moved;
+        std::map<std::string, int> posmap;
+        for (int i = 0; i < table_info.columns.size(); i++)
+          posmap[table_info.columns[i]] = i;
+
+        // rowids by the site they were read from
+        std::map<std::string, std::vector<std::variant<int64_t, std::string>>>
+            moved_ids, kept_ids, kept_keys;
+        std::vector<std::variant<int64_t, std::string>> old_keys;
+        std::set<std::variant<int64_t, std::string>> new_keys;
+
+        for (size_t f = 0; f < results.size(); f++) {
+          auto &&sname = read_sites[f];
+          auto rows = results[f].get();
+          // the first row holds the column names
+          for (size_t r = 1; r < rows.size(); r++) {
+            auto &&row = rows[r];
+            auto nulls = row.back();
+            std::vector<std::variant<int64_t, std::string>> values;
+            for (int i = 0; i < table_info.columns.size(); i++) {
+              // a null keeps its empty string, it is not inserted
+              if (nulls[i] != '1' &&
+                  table_info.column_type[table_info.columns[i]] == "int")
+                values.emplace_back((int64_t)std::stoll(row[i + 1]));
+              else
+                values.emplace_back(row[i + 1]);
+            }
+            if (pk.size() && nulls[posmap[pk]] != '1')
+              old_keys.push_back(values[posmap[pk]]);
+            for (auto &&[col, val] : stmt.sets) {
+              values[posmap[col]] = val;
+              nulls[posmap[col]] = '0';
+            }
+            if (pk.size() && nulls[posmap[pk]] != '1')
+              new_keys.insert(values[posmap[pk]]);
+            for (int i = 0; i < table_info.columns.size(); i++)
+              if (nulls[i] == '1' && frag_cols.count(table_info.columns[i]))
+                throw std::runtime_error("updated row with a null " +
+                                         table_info.columns[i] +
+                                         " fits no fragment");
+
+            InsertStmt one{stmt.table_name, table_info.columns, {values}};
+            auto target = insertStmtToSites(one, &db->meta);
+            if (target.empty())
+              throw std::runtime_error("updated row fits no fragment");
+
+            int64_t rowid = std::stoll(row[0]);
+            if (target.begin()->first == sname) {
+              kept_ids[sname].push_back(rowid);
+              if (pk.size() && nulls[posmap[pk]] != '1')
+                kept_keys[sname].push_back(values[posmap[pk]]);
+              continue;
+            }
+
+            moved_ids[sname].push_back(rowid);
+            auto &group = moved[nulls];
+            if (group.columns.empty()) {
+              group.table_name = stmt.table_name;
+              for (int i = 0; i < table_info.columns.size(); i++)
+                if (nulls[i] != '1')
+                  group.columns.push_back(table_info.columns[i]);
+            }
+            group.values.emplace_back();
+            for (int i = 0; i < table_info.columns.size(); i++)
+              if (nulls[i] != '1')
+                group.values.back().push_back(std::move(values[i]));
+            moved_rows++;
+          }
+        }
+
+        // the insert points the keys of moved rows at their new site
+        std::vector<seastar::future<std::string>> insert_futs;
+        for (auto &&[mask, group] : moved)
+          insert_futs.emplace_back(
+              exec_insert_sites(db, insertStmtToSites(group, &db->meta)));
+        for (auto &&fut :
+             seastar::when_all(insert_futs.begin(), insert_futs.end()).get())
+          fut.get();
+
+        std::vector<seastar::future<>> index_futs;
+        for (auto &&[sname, keys] : kept_keys)
+          index_futs.emplace_back(
+              gidx_update(db, stmt.table_name, keys, sname));
+        std::vector<std::variant<int64_t, std::string>> stale_keys;
+        for (auto &&key : old_keys)
+          if (!new_keys.count(key))
+            stale_keys.push_back(key);
+        if (stale_keys.size())
+          index_futs.emplace_back(
+              gidx_update(db, stmt.table_name, stale_keys, ""));
+        for (auto &&fut :
+             seastar::when_all(index_futs.begin(), index_futs.end()).get())
+          fut.get();
+
+        for (auto &&[sname, ids] : moved_ids) {
+          auto frag = rowids_exec(
+              db, sname,
+              "delete from " + std::get<0>(table_info.hfrag_conds[sname]), {},
+              ids);
+          std::move(frag.begin(), frag.end(), std::back_inserter(futs));
+        }
+        for (auto &&[sname, ids] : kept_ids) {
+          std::vector<std::variant<int64_t, std::string>> params;
+          auto sql = "update " + std::get<0>(table_info.hfrag_conds[sname]) +
+                     sets_sql(stmt.sets, params);
+          auto frag = rowids_exec(db, sname, sql, params, ids);
+          std::move(frag.begin(), frag.end(), std::back_inserter(futs));
+        }
+        for (auto &&fut : seastar::when_all(futs.begin(), futs.end()).get())
+          fut.get();
+        futs.clear();
+      } else {
+        for (auto &&fut : results)
+          fut.get();
+      }
+
+      if (table_info.vfrag_cols.size()) {
+        FragSqls frag_sqls;
+        for (auto &&[sname, sdata] : table_info.vfrag_cols) {
+          auto &&[fname, cols] = sdata;
+          decltype(stmt.sets) frag_sets;
+          for (auto &&set : stmt.sets)
+            if (std::find(cols.begin(), cols.end(), std::get<0>(set)) !=
+                cols.end())
+              frag_sets.push_back(set);
+          if (frag_sets.empty())
+            continue;
+
+          std::vector<std::variant<int64_t, std::string>> params;
+          auto sql = "update " + fname + sets_sql(frag_sets, params);
+          frag_sqls[sname] = {sql, params};
+        }
+
+        if (stmt.conds.empty()) {
+          for (auto &&[sname, frag_sql] : frag_sqls)
+            futs.emplace_back(site_exec_sql(db, sname, std::get<0>(frag_sql),
+                                            std::get<1>(frag_sql)));
+        } else {
+          futs = vfrag_exec_keys(
+              db, table_info, vfrag_matching_keys(db, table_info, stmt.conds),
+              frag_sqls);
+        }
+
+        for (auto &&fut : seastar::when_all(futs.begin(), futs.end()).get())
+          fut.get();
+      }
+
+      if (moved_rows)
+        return {{fmt::format("updated, {} rows moved", moved_rows)}};
+      return {{"updated"}};
+    });
+  }
+
+  // table, column, fragment, hits, selectivity and average ms of the
+  // indexes advised for this site's fragments
+  std::vector<std::vector<std::string>> local_advise_index(DbContext *db) {
+    std::vector<std::vector<std::string>> ret;
+    auto advice =
+        db->advisor.advise(db->conn, config.index_advisor_min_hits,
+                           config.index_advisor_max_selectivity);
+
+    for (auto &&a : advice)
+      for (auto &&[tname, tmeta] : db->meta.tables) {
+        auto frags = local_fragments(db, tname);
+        if (std::find(frags.begin(), frags.end(), a.fragment) == frags.end())
+          continue;
+
+        ret.push_back({tname, a.column, a.fragment, std::to_string(a.hits),
+                       fmt::format("{:.4f}", a.selectivity),
+                       fmt::format("{:.3f}", a.avg_ms)});
+        break;
+      }
+
+    return ret;
+  }
+
+  // build the top advised index on this site's fragments of each database.
+  // it goes through createindex like adviseindex apply, so every site's
+  // catalog records it. sqlite builds an index synchronously on the
+  // reactor; one index per tick with no tick starting while the last one
+  // still builds bounds that stall to a single index build at a time, and
+  // nothing is built while an import holds the database in bulk mode
+  void auto_create_index() {
+    if (auto_index_running)
+      return;
+
+    std::vector<std::tuple<std::string, std::string>> commands;
+    for (auto &&[dbname, ctx] : db_contexts) {
+      auto db = ctx.get();
+      if (db->bulk.loads > 0)
+        continue;
+
+      auto advice = local_advise_index(db);
+      if (advice.empty())
+        continue;
+
+      auto &&top = advice.front();
+      commands.emplace_back(dbname, "createindex " + top[0] + " " + top[1]);
+      db->advisor.forget(top[2], top[1]);
+    }
+    if (commands.empty())
+      return;
+
+    auto_index_running = true;
+    (void)seastar::do_with(std::move(commands), [this](auto &commands) {
+      return seastar::do_for_each(commands, [this](auto &command) {
+        return exec_sql_(std::get<0>(command), std::get<1>(command))
+            .discard_result()
+            .handle_exception([](std::exception_ptr ep) {
+              fmt::print(stderr, "Could not create advised index: {}\n", ep);
+            });
+      });
+    }).finally([this] { auto_index_running = false; });
+  }
 
-    return exec_insert_sites(std::move(site_ins_stmt));
+  // adviseindex [apply]: collect the advice of every site, and with apply
+  // create each advised index through createindex
+  seastar::future<std::vector<std::vector<std::string>>>
+  advise_index(DbContext *db, bool apply) {
+    std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
+    for (auto sname : sites)
+      futs.emplace_back(rpc_advise_index(*pclients[sname], db->name));
+
+    return seastar::when_all(futs.begin(), futs.end())
+        .then([this, db, apply](auto futs) {
+          std::vector<std::vector<std::string>> ret{
+              {"site", "table", "column", "fragment", "hits", "selectivity",
+               "avg_ms"}};
+          std::set<std::string> commands;
+
+          for (int i = 0; i < futs.size(); i++)
+            for (auto &&row : futs[i].get()) {
+              ret.push_back({sites[i]});
+              ret.back().insert(ret.back().end(), row.begin(), row.end());
+              commands.insert("createindex " + row[0] + " " + row[1]);
+            }
+
+          if (!apply)
+            return seastar::make_ready_future<
+                std::vector<std::vector<std::string>>>(std::move(ret));
+
+          return seastar::do_with(
+              std::move(commands), std::move(ret),
+              [this, db](auto &commands, auto &ret) {
+                return seastar::do_for_each(
+                           commands,
+                           [this, db](auto &command) {
+                             return exec_sql_(db->name, command)
+                                 .discard_result();
+                           })
+                    .then([&ret]() { return std::move(ret); });
+              });
+        });
   }
 
-  void sql_control(std::string command, std::string type) {
+  // db is null for close
+  void sql_control(DbContext *db, std::string command, std::string type) {
     std::cout << "Control cmd " << type << ' ' << command << std::endl;
 
     if (type == "createdb") {
-      add_db_conn(command);
-    } else if (type == "usedb") {
-      if (db_conns.count(command) == 0)
-        add_db_conn(command);
-      pdb = db_conns[command];
-      pdb_meta = db_metas[command].get();
+      // the rpc handler already opened it
     } else if (type == "createtable") {
       std::vector<std::string> metas;
-      std::vector<std::vector<std::string>> rows;
-      auto sqls = parseCreateTable(command, pdb_meta, &metas);
-      rows.push_back({{"text"}});
+      std::vector<std::vector<std::variant<int64_t, std::string>>> rows;
+      auto sqls = parseCreateTable(command, &db->meta, &metas);
       for (auto meta : metas)
-        rows.push_back({{meta}});
+        rows.push_back({meta});
 
-      local_insert("frags", rows);
+      local_insert(db, "frags", {"text"}, rows);
 
       if (sqls.count(config.name)) {
-        local_exec_sql(sqls[config.name]);
+        local_exec_sql(db, sqls[config.name]);
       }
+    } else if (type == "createindex") {
+      // the index is built and recorded in frags in one transaction, and
+      // the metadata only learns of it after the commit, so a failed build
+      // leaves no entry behind
+      std::vector<std::string> metas;
+      auto sqls = parseCreateIndex(command, &db->meta, &metas);
+
+      SQLite::Transaction transaction(db->conn);
+      if (sqls.count(config.name))
+        db->conn.exec(sqls[config.name]);
+
+      SQLite::Statement record(db->conn, "insert into frags (text) values (?)");
+      for (auto &&meta : metas) {
+        record.bind(1, meta);
+        record.exec();
+        record.reset();
+      }
+      transaction.commit();
+
+      for (auto &&meta : metas)
+        processCreateMeta(meta, &db->meta);
+    } else if (type == "createpkindex") {
+      std::vector<std::string> metas;
+      auto table = parseCreatePkIndex(command, &db->meta, &metas);
+      std::vector<std::vector<std::variant<int64_t, std::string>>> rows;
+      for (auto meta : metas)
+        rows.push_back({meta});
+
+      if (rows.size())
+        local_insert(db, "frags", {"text"}, rows);
+
+      db->conn.exec("create table if not exists gidx_" + table +
+                    " (k primary key, sites text)");
+    } else if (type == "bulkbegin") {
+      local_bulk_begin(db, command);
+    } else if (type == "bulkend") {
+      local_bulk_end(db, command);
     } else if (type == "close") {
       if (config.name == command)
         exit(0);
     }
   }
 
+  // sql runs against the database dbname. the session keeps its database,
+  // see usedb in TcpCliEngine
   seastar::future<std::vector<std::vector<std::string>>>
-  exec_sql_(std::string sql) {
+  exec_sql_(std::string dbname, std::string sql) {
     if (boost::starts_with(sql, "createdb")) {
       std::vector<std::string> tokens;
       boost::split(tokens, sql, boost::is_any_of(" \t;"));
 
       std::vector<seastar::future<int>> futs_int;
       for (auto sname : sites) {
-        futs_int.emplace_back(
-            std::move(rpc_control(*pclients[sname], tokens[1], "createdb")));
+        futs_int.emplace_back(std::move(
+            rpc_control(*pclients[sname], tokens[1], tokens[1], "createdb")));
       }
 
       return seastar::when_all(futs_int.begin(), futs_int.end())
@@ -540,22 +2121,6 @@ public:
               fut.get();
             return {{"created"}};
           });
-    } else if (boost::starts_with(sql, "usedb")) {
-      std::vector<std::string> tokens;
-      boost::split(tokens, sql, boost::is_any_of(" \t;"));
-
-      std::vector<seastar::future<int>> futs_int;
-      for (auto sname : sites) {
-        futs_int.emplace_back(
-            std::move(rpc_control(*pclients[sname], tokens[1], "usedb")));
-      }
-
-      return seastar::when_all(futs_int.begin(), futs_int.end())
-          .then([](auto futs) -> std::vector<std::vector<std::string>> {
-            for (auto &&fut : futs)
-              fut.get();
-            return {{"changed"}};
-          });
     } else if (boost::starts_with(sql, "close")) {
       std::vector<std::string> tokens;
       boost::split(tokens, sql, boost::is_any_of(" \t;"));
@@ -563,7 +2128,7 @@ public:
       std::vector<seastar::future<int>> futs_int;
       for (auto sname : sites) {
         futs_int.emplace_back(
-            std::move(rpc_control(*pclients[sname], tokens[1], "close")));
+            std::move(rpc_control(*pclients[sname], "", tokens[1], "close")));
       }
 
       return seastar::when_all(futs_int.begin(), futs_int.end())
@@ -574,60 +2139,70 @@ public:
           });
     }
 
-    if (pdb == nullptr) {
-      return seastar::make_ready_future<>().then(
-          []() -> std::vector<std::vector<std::string>> {
-            return {{"no database selected"}};
-          });
-    }
+    if (dbname.empty())
+      return seastar::make_exception_future<
+          std::vector<std::vector<std::string>>>(
+          std::runtime_error("no database selected"));
+    auto db = db_context(dbname);
 
     if (boost::starts_with(sql, "import")) {
+      // import <table> <file> [shared]
       std::vector<std::string> tokens;
-      boost::split(tokens, sql, boost::is_any_of(" \t"));
-
-      return insert_from_file(tokens[1], tokens[2])
+      boost::split(tokens, sql, boost::is_any_of(" \t;"),
+                   boost::token_compress_on);
+
+      auto table = tokens[1], filename = tokens[2];
+      bool shared = tokens.size() > 3 && tokens[3] == "shared";
+
+      return bulk_load_control(db, table, "bulkbegin")
+          .then([this, db, table, filename, shared]() {
+            return shared ? insert_from_shared_file(db, table, filename)
+                          : insert_from_file(db, table, filename);
+          })
+          .finally([this, db, table]() {
+            return bulk_load_control(db, table, "bulkend");
+          })
           .then([](std::string s) -> std::vector<std::vector<std::string>> {
             return {{s}};
           });
     } else if (boost::starts_with(sql, "insert")) {
-      auto insert = parseInsertStmt(sql, pdb_meta);
-      auto sites = insertStmtToSites(insert, pdb_meta);
+      auto insert = parseInsertStmt(sql, &db->meta);
+      auto sites = insertStmtToSites(insert, &db->meta);
 
-      return exec_insert_sites(std::move(sites))
-          .then([](std::string s) -> std::vector<std::vector<std::string>> {
+      auto inserted = config.insert_buffer_rows
+                          ? buffer_insert_sites(db, std::move(sites))
+                          : exec_insert_sites(db, std::move(sites));
+
+      return inserted.then(
+          [](std::string s) -> std::vector<std::vector<std::string>> {
             return {{s}};
           });
     } else if (boost::starts_with(sql, "delete")) {
-      std::vector<std::string> tokens;
-      boost::split(tokens, sql, boost::is_any_of(" \t;"));
-
-      auto tablename = tokens[2];
-
-      std::vector<seastar::future<std::vector<std::vector<std::string>>>> futs;
-
-      for (auto &&[sname, sdata] : pdb_meta->tables[tablename].hfrag_conds) {
-        auto &&[fname, data] = sdata;
-        futs.emplace_back(
-            std::move(rpc_sql_exec(*pclients[sname], "delete from " + fname)));
-      }
-
-      for (auto &&[sname, sdata] : pdb_meta->tables[tablename].vfrag_cols) {
-        auto &&[fname, data] = sdata;
-        futs.emplace_back(
-            std::move(rpc_sql_exec(*pclients[sname], "delete from " + fname)));
+      return exec_delete(db, parseDeleteStmt(sql, &db->meta));
+    } else if (boost::starts_with(sql, "update")) {
+      return exec_update(db, parseUpdateStmt(sql, &db->meta));
+    } else if (boost::starts_with(sql, "adviseindex")) {
+      return advise_index(db, sql.find("apply") != std::string::npos);
+    } else if (boost::starts_with(sql, "createpkindex")) {
+      return create_pk_index(db, sql);
+    } else if (boost::starts_with(sql, "createindex")) {
+      std::vector<seastar::future<int>> futs_int;
+      for (auto sname : sites) {
+        futs_int.emplace_back(std::move(
+            rpc_control(*pclients[sname], db->name, sql, "createindex")));
       }
 
-      return seastar::when_all(futs.begin(), futs.end())
+      return seastar::when_all(futs_int.begin(), futs_int.end())
           .then([](auto futs) -> std::vector<std::vector<std::string>> {
             for (auto &&fut : futs)
               fut.get();
-            return {{"deleted"}};
+            return {{"indexed"}};
           });
     } else if (boost::starts_with(sql, "createtable")) {
       std::vector<seastar::future<int>> futs_int;
       for (auto sname : sites) {
-        futs_int.emplace_back(
-            std::move(rpc_control(*pclients[sname], sql, "createtable")));
+        futs_int.emplace_back(std::move(
+            rpc_control(*pclients[sname], db->name, sql, "createtable")));
       }
 
       return seastar::when_all(futs_int.begin(), futs_int.end())
@@ -638,12 +2213,165 @@ public:
           });
     }
 
-    auto result = parseSelectStmt(sql, pdb_meta);
-    auto node = buildRawNodeTreeFromSelectStmt(result, pdb_meta);
-    pushDownAndOptimize(node.get(), {}, {}, "", pdb_meta);
+    auto result = parseSelectStmt(sql, &db->meta);
+    if (auto point = exec_point_query(db, result))
+      return std::move(*point);
+
+    auto node = buildRawNodeTreeFromSelectStmt(result, &db->meta);
+    pushDownAndOptimize(node.get(), {}, {}, "", &db->meta);
+
+    // a key equality on a table with a global key index only reads the
+    // fragments the index lists for that key
+    std::vector<std::string> lookup_tables;
+    std::vector<seastar::future<std::string>> lookups;
+    for (auto &&tname : result.table_names) {
+      auto &&pk = db->meta.tables[tname].pk_index;
+      if (pk.empty())
+        continue;
+
+      for (auto &&cond : result.filter_conds)
+        if (cond.op == CompareOps::EQ &&
+            cond.val1 == format_column_name(tname, pk)) {
+          lookup_tables.push_back(tname);
+          lookups.emplace_back(site_gidx_lookup(db, tname, cond.val2));
+          break;
+        }
+    }
+
+    if (lookups.empty())
+      return exec_select_node(db, node, PlanSource{sql, {}});
+
+    return seastar::when_all_succeed(lookups.begin(), lookups.end())
+        .then([this, db, node, sql, lookup_tables](auto row_sites) {
+          PlanSource src{sql, {}};
+          for (size_t i = 0; i < lookup_tables.size(); i++) {
+            std::vector<std::string> keep;
+            if (row_sites[i].size())
+              boost::split(keep, row_sites[i], boost::is_any_of(","));
+            keep.insert(keep.begin(), lookup_tables[i]);
+            src.pruned.push_back(std::move(keep));
+          }
+          prune_read_sites(node.get(), src.pruned);
+
+          return exec_select_node(db, node, std::move(src));
+        });
+  }
+
+  // the fragments a single table query reads, each with its own where
+  // clause. header holds the result column names sorted like the planned
+  // path, cols the same columns without the table prefix
+  struct FragmentScan {
+    std::string site;
+    std::string fragment;
+    std::string where;
+    std::vector<std::variant<int64_t, std::string>> params;
+  };
+
+  struct ScanPlan {
+    std::vector<std::string> header;
+    std::vector<std::string> cols;
+    std::vector<FragmentScan> scans;
+  };
+
+  // single table queries without joins over a horizontally fragmented
+  // table read their fragments directly, without building a plan
+  std::optional<ScanPlan> plan_scan(DbContext *db, const SelectStmt &stmt) {
+    if (stmt.table_names.size() != 1 || stmt.join_conds.size())
+      return {};
+
+    auto &&tname = stmt.table_names[0];
+    auto &&table_info = db->meta.tables[tname];
+    if (table_info.frag_type != TableMetadata::HFRAG ||
+        table_info.hfrag_conds.empty())
+      return {};
+
+    std::vector<CompareConds> conds;
+    for (auto cond : stmt.filter_conds) {
+      auto [ctable, cname] = split_column_name(cond.val1);
+      if (ctable != tname)
+        return {};
+      cond.val1 = cname;
+      conds.push_back(cond);
+    }
+
+    ScanPlan plan;
+    std::set<std::string> proj(stmt.proj_columns.begin(),
+                               stmt.proj_columns.end());
+    plan.header.assign(proj.begin(), proj.end());
+    for (auto &&name : plan.header) {
+      auto [ctable, cname] = split_column_name(name);
+      if (ctable != tname)
+        return {};
+      plan.cols.push_back(cname);
+    }
+
+    for (auto &&[sname, sdata] : table_info.hfrag_conds) {
+      auto &&[fname, frag_conds] = sdata;
+
+      auto all_conds = frag_conds;
+      all_conds.insert(all_conds.end(), conds.begin(), conds.end());
+      if (condsUnsatisfiable(all_conds))
+        continue;
+
+      FragmentScan scan{sname, fname};
+      scan.where = conds_where_sql(conds, scan.params);
+      plan.scans.push_back(std::move(scan));
+    }
+
+    return plan;
+  }
+
+  std::optional<ScanPlan> plan_scan_sql(const std::string &dbname,
+                                       const std::string &sql) {
+    auto db = db_context(dbname);
+    return plan_scan(db, parseSelectStmt(sql, &db->meta));
+  }
+
+  // up to limit rows of one fragment scan after rowid after, in rowid
+  // order. the first column of the rows is their rowid, so the next page
+  // starts where this one stopped without sqlite skipping an offset
+  seastar::future<std::vector<std::vector<std::string>>>
+  fetch_scan_page(const std::string &dbname, const ScanPlan &plan,
+                  const FragmentScan &scan, int64_t after, size_t limit) {
+    auto params = scan.params;
+    params.emplace_back(after);
+    params.emplace_back((int64_t)limit);
+    auto sql = "select rowid, " + boost::algorithm::join(plan.cols, ", ") +
+               " from " + scan.fragment + scan.where +
+               " and rowid > ? order by rowid limit ?;";
+    return site_exec_sql(db_context(dbname), scan.site, sql, params);
+  }
+
+  // a scan that leaves at most one fragment is sent to that fragment as
+  // one statement
+  std::optional<seastar::future<std::vector<std::vector<std::string>>>>
+  exec_point_query(DbContext *db, const SelectStmt &stmt) {
+    auto plan = plan_scan(db, stmt);
+    if (!plan || plan->scans.size() > 1)
+      return {};
+
+    auto &&header = plan->header;
+    if (plan->scans.empty())
+      return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
+          std::vector<std::vector<std::string>>{header});
+
+    auto &&scan = plan->scans[0];
+    auto sql = "select " + boost::algorithm::join(plan->cols, ", ") +
+               " from " + scan.fragment + scan.where + ";";
+
+    return site_exec_sql(db, scan.site, sql, scan.params)
+        .then([header](auto result) {
+          result[0] = header;
+          return result;
+        });
+  }
+
+  seastar::future<std::vector<std::vector<std::string>>>
+  exec_select_node(DbContext *db, std::shared_ptr<BasicNode> node,
+                   PlanSource src) {
     std::vector<std::shared_ptr<BasicNode>> nodes;
-    auto copy = node->copy(pdb_meta, nodes);
-    copy->optimizeExecNode(pdb_meta);
+    auto copy = node->copy(&db->meta, nodes);
+    copy->optimizeExecNode(&db->meta);
 
     // for (auto node : nodes) {
     //   auto ptr = node.get();
@@ -653,17 +2381,58 @@ public:
 
     std::cout << copy->to_string() << std::endl;
 
-    return seastar::async([this, copy, sql]() {
-      auto ret = exec_query_node(copy.get(), sql).get();
+    return exec_plan(db, copy, std::move(nodes), src).then([copy](auto ret) {
       std::cout << copy->to_string() << std::endl;
       return ret;
     });
   }
 
+  // catalog type of a result column named table.column, empty if unknown
+  std::string result_column_type(const std::string &dbname,
+                                 const std::string &name) {
+    auto [table, column] = split_column_name(name);
+    auto ctx = db_contexts.find(dbname);
+    if (ctx == db_contexts.end() || !ctx->second->meta.tables.count(table))
+      return "";
+
+    auto &&types = ctx->second->meta.tables[table].column_type;
+    auto it = types.find(column);
+    return it == types.end() ? "" : it->second;
+  }
+
+  // fragments a select is expected to read, the pruned scans of a single
+  // table query or every fragment of each joined table. the database is
+  // opened as running the query would, so the first query of a database
+  // is counted too. 0 when the sql does not parse, its error comes from
+  // running it
+  size_t fragment_reads(const std::string &dbname, const std::string &sql) {
+    try {
+      auto db = db_context(dbname);
+      auto stmt = parseSelectStmt(sql, &db->meta);
+      if (auto plan = plan_scan(db, stmt))
+        return plan->scans.size();
+
+      size_t reads = 0;
+      for (auto &&tname : stmt.table_names) {
+        auto it = db->meta.tables.find(tname);
+        if (it == db->meta.tables.end())
+          continue;
+        reads += it->second.frag_type == TableMetadata::HFRAG
+                     ? it->second.hfrag_conds.size()
+                     : it->second.vfrag_cols.size();
+      }
+      return reads;
+    } catch (...) {
+      return 0;
+    }
+  }
+
+  // a failed statement fails the future rather than answering with its
+  // message as a row, so callers can tell errors from results
   seastar::future<std::vector<std::vector<std::string>>>
-  exec_sql(std::string sql) {
+  exec_sql(std::string dbname, std::string sql) {
     return seastar::make_ready_future<>()
-        .then([this, sql]() {
+        .then([this, dbname, sql]() {
           std::vector<std::string> closed_clients;
           for (auto &&[sname, client] : pclients) {
             if (client->error()) {
@@ -681,20 +2450,19 @@ public:
                                          std::get<1>(config.nodes[sname])})));
           }
 
-          return exec_sql_(sql);
+          return exec_sql_(dbname, sql);
         })
-        .handle_exception_type([this](seastar::rpc::closed_error &e)
-                                   -> std::vector<std::vector<std::string>> {
+        .handle_exception_type([this](seastar::rpc::closed_error &e) {
+          std::string msg = e.what();
           for (auto &&[sname, client] : pclients) {
-            if (client->error())
-              return {{"connection from " + sname + " closed"}};
+            if (client->error()) {
+              msg = "connection from " + sname + " closed";
+              break;
+            }
           }
-          return {{e.what()}};
-        })
-        .handle_exception_type(
-            [this](std::exception &e) -> std::vector<std::vector<std::string>> {
-              return {{e.what()}};
-            });
+          return seastar::make_exception_future<
+              std::vector<std::vector<std::string>>>(std::runtime_error(msg));
+        });
   }
 };
 
@@ -1,6 +1,7 @@
 #include <seastar/rpc/rpc.hh>
 
 #include <type_traits>
+#include <variant>
 #include <vector>
 #include <string>
 
@@ -59,7 +60,7 @@ inline uint64_t read(serializer, Input &input, rpc::type<uint64_t>) {
   return read_arithmetic_type<uint64_t>(input);
 }
 template <typename Input>
-inline uint64_t read(serializer, Input &input, rpc::type<int64_t>) {
+inline int64_t read(serializer, Input &input, rpc::type<int64_t>) {
   return read_arithmetic_type<int64_t>(input);
 }
 template <typename Input>
@@ -81,6 +82,26 @@ inline std::string read(serializer, Input &in, rpc::type<std::string>) {
   return ret;
 }
 
+template <typename Output>
+inline void write(serializer s, Output &out,
+                  const std::variant<int64_t, std::string> &v) {
+  write_arithmetic_type(out, uint8_t(v.index()));
+  if (v.index() == 0)
+    write(s, out, std::get<0>(v));
+  else
+    write(s, out, std::get<1>(v));
+}
+
+template <typename Input>
+inline std::variant<int64_t, std::string>
+read(serializer s, Input &in, rpc::type<std::variant<int64_t, std::string>>) {
+  auto index = read_arithmetic_type<uint8_t>(in);
+  if (index == 0)
+    return read(s, in, rpc::type<int64_t>());
+  else
+    return read(s, in, rpc::type<std::string>());
+}
+
 template <typename Output, typename Container>
 inline void write_container(serializer s, Output &output, const Container& container)
 {
@@ -0,0 +1,56 @@
+#ifndef _STATEMENT_CACHE_HH
+#define _STATEMENT_CACHE_HH
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+// lru cache of prepared statements of one sqlite connection, keyed by sql
+// text, so repeated query shapes skip sqlite's prepare step
+class StatementCache {
+  using Entry = std::pair<std::string, std::shared_ptr<SQLite::Statement>>;
+
+  SQLite::Database &db;
+  size_t capacity;
+  std::list<Entry> lru;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index;
+
+public:
+  StatementCache(SQLite::Database &db, size_t capacity = 128)
+      : db(db), capacity(capacity) {}
+
+  // returns a reset statement with no bindings
+  std::shared_ptr<SQLite::Statement> get(const std::string &sql) {
+    auto it = index.find(sql);
+    if (it != index.end()) {
+      lru.splice(lru.begin(), lru, it->second);
+
+      auto stmt = it->second->second;
+      stmt->reset();
+      stmt->clearBindings();
+      return stmt;
+    }
+
+    auto stmt = std::make_shared<SQLite::Statement>(db, sql);
+    lru.emplace_front(sql, stmt);
+    index[sql] = lru.begin();
+
+    if (lru.size() > capacity) {
+      index.erase(lru.back().first);
+      lru.pop_back();
+    }
+
+    return stmt;
+  }
+
+  void clear() {
+    index.clear();
+    lru.clear();
+  }
+};
+
+#endif
@@ -1,69 +1,671 @@
+#include <algorithm>
+#include <charconv>
+#include <limits>
 #include <seastar/core/future.hh>
 #include <sstream>
 
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
 #include <seastar/core/future-util.hh>
+#include <seastar/core/gate.hh>
+#include <seastar/core/lowres_clock.hh>
 #include <seastar/core/reactor.hh>
+#include <seastar/core/scheduling.hh>
+#include <seastar/core/semaphore.hh>
 #include <seastar/core/seastar.hh>
 #include <seastar/core/temporary_buffer.hh>
+#include <seastar/core/timer.hh>
+#include <seastar/core/with_scheduling_group.hh>
 #include <seastar/net/api.hh>
 
 #include <rpc-engine.hh>
 
 class TcpCliEngine {
   SqlRpcEngine *pengine;
+  size_t max_inflight;
+  uint32_t max_frame_bytes;
+  std::chrono::milliseconds cursor_idle;
 
-public:
-  TcpCliEngine(SqlRpcEngine *pengine) : pengine(pengine) {}
-  seastar::future<> handle_connection(seastar::connected_socket s,
-                                      seastar::socket_address a) {
-    auto out = s.output();
-    auto in = s.input();
-    seastar::temporary_buffer<char> c;
-    return do_with(
-        std::move(s), std::move(out), std::move(in),
-        [this](auto &s, auto &out, auto &in) {
-          return seastar::repeat([&out, &in, this] {
-                   return in.read().then([&out, this](auto buf) {
-                     if (buf.size() == 0)
+  // queries are admitted per class, each class running in its own
+  // scheduling group so that lookups keep their share of the reactor
+  // while analytic queries and imports queue behind their own limits
+  struct QueryClass {
+    const char *name;
+    unsigned shares;
+    seastar::semaphore slots;
+    seastar::scheduling_group group;
+
+    QueryClass(const char *name, unsigned shares, size_t slots)
+        : name(name), shares(shares), slots(slots) {}
+  };
+
+  QueryClass interactive, analytic, imports;
+  size_t fragment_read_kb;
+  // kilobytes of memory that admitted analytic queries hold. lookups
+  // never wait here, so a queued join cannot hold them back
+  size_t query_memory_kb;
+  seastar::semaphore query_memory;
+
+  // "declare <name> [cursor for] <select>" opens a cursor of the
+  // connection, "fetch <n> [from] <name>" answers its next n rows and
+  // "close cursor <name>" drops it. single table queries over horizontal
+  // fragments are read a page at a time, one fragment after another, so
+  // only fetched pages are computed. other queries run once on the first
+  // fetch and their rows are handed out page by page
+  struct Cursor {
+    std::string dbname;
+    std::string sql;
+    std::optional<SqlRpcEngine::ScanPlan> plan;
+    size_t scan = 0;
+    int64_t after = std::numeric_limits<int64_t>::min();
+    bool ran = false;
+    std::vector<std::vector<std::string>> rows;
+    size_t next = 1;
+    seastar::semaphore busy{1};
+    seastar::lowres_clock::time_point last_used = seastar::lowres_clock::now();
+  };
+
+  // a request is [u32 length][u32 id][length bytes of sql]. it is answered
+  // by data frames [u32 length][u32 id]['D'][text] holding whole rows,
+  // then one [u32 length][u32 id]['E'][text] frame with the row count. up
+  // to max_inflight requests of a connection run at once and frames of
+  // different requests may interleave. a request over max_frame_bytes is
+  // answered by an error frame and the connection is closed.
+  //
+  // a request that fails is answered by one [u32 length][u32 id]['X'][text]
+  // frame with the error in place of the end frame, possibly after some of
+  // its data frames.
+  //
+  // after "format binary" the rows come as one ['S'] schema frame
+  // [u16 columns]([u8 type][u32 length][name])... and ['B'] batch frames
+  // [u32 rows] followed by each column in turn: int64 values, or strings
+  // as [u32 length][bytes]. statements that return no rows only send the
+  // end frame, holding their status. "format text" switches back
+  struct Connection {
+    seastar::connected_socket s;
+    seastar::input_stream<char> in;
+    seastar::output_stream<char> out;
+    seastar::semaphore inflight;
+    seastar::semaphore write_lock{1};
+    seastar::gate requests;
+    bool binary = false;
+    std::string dbname;
+    std::map<std::string, std::shared_ptr<Cursor>> cursors;
+    seastar::timer<seastar::lowres_clock> cursor_reaper;
+
+    Connection(seastar::connected_socket socket, size_t max_inflight)
+        : s(std::move(socket)), in(s.input()), out(s.output()),
+          inflight(max_inflight) {}
+  };
+
+  enum : char {
+    FRAME_DATA = 'D',
+    FRAME_END = 'E',
+    FRAME_SCHEMA = 'S',
+    FRAME_BATCH = 'B',
+    FRAME_ERROR = 'X'
+  };
+  enum : uint8_t { COLUMN_INT64 = 1, COLUMN_STRING = 2 };
+
+  // rows are cut into data frames of about this size
+  static constexpr size_t result_chunk_bytes = 64 * 1024;
+
+  static seastar::temporary_buffer<char>
+  make_frame(uint32_t id, char kind, const std::string &str) {
+    seastar::temporary_buffer<char> frame(str.size() + 9);
+    uint32_t len = str.size();
+    memcpy(frame.get_write(), &len, 4);
+    memcpy(frame.get_write() + 4, &id, 4);
+    frame.get_write()[8] = kind;
+    memcpy(frame.get_write() + 9, str.data(), str.size());
+    return frame;
+  }
+
+  // frames of concurrent requests must not interleave byte-wise
+  seastar::future<> write_frame(Connection &conn, uint32_t id, char kind,
+                                const std::string &str) {
+    auto frame = make_frame(id, kind, str);
+    return seastar::with_semaphore(
+        conn.write_lock, 1, [&conn, frame = std::move(frame)]() mutable {
+          return conn.out.write(std::move(frame)).then([&conn] {
+            return conn.out.flush();
+          });
+        });
+  }
+
+  template <typename T> static void append_raw(std::string &buf, T v) {
+    buf.append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+
+  static bool parse_int64(const std::string &str, int64_t &v) {
+    auto end = str.data() + str.size();
+    auto [ptr, ec] = std::from_chars(str.data(), end, v);
+    return ec == std::errc() && ptr == end;
+  }
+
+  // catalog int columns are sent as int64 unless a value does not parse
+  std::vector<uint8_t>
+  column_types(const std::string &dbname,
+               const std::vector<std::vector<std::string>> &vals) {
+    std::vector<uint8_t> types;
+    for (size_t i = 0; i < vals[0].size(); i++) {
+      bool is_int = pengine->result_column_type(dbname, vals[0][i]) == "int";
+      int64_t v;
+      for (size_t r = 1; is_int && r < vals.size(); r++)
+        is_int = parse_int64(vals[r][i], v);
+      types.push_back(is_int ? COLUMN_INT64 : COLUMN_STRING);
+    }
+    return types;
+  }
+
+  static std::string schema_frame(const std::vector<std::string> &names,
+                                  const std::vector<uint8_t> &types) {
+    std::string buf;
+    append_raw<uint16_t>(buf, names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+      append_raw<uint8_t>(buf, types[i]);
+      append_raw<uint32_t>(buf, names[i].size());
+      buf += names[i];
+    }
+    return buf;
+  }
+
+  static std::string text_chunk(std::vector<std::vector<std::string>> &vals,
+                                size_t &next) {
+    std::string chunk;
+    while (next < vals.size() && chunk.size() < result_chunk_bytes) {
+      for (auto &&v : vals[next]) {
+        chunk += v;
+        chunk += '\t';
+      }
+      chunk += '\n';
+      std::vector<std::string>().swap(vals[next++]);
+    }
+    return chunk;
+  }
+
+  static std::string batch_chunk(std::vector<std::vector<std::string>> &vals,
+                                 size_t &next,
+                                 const std::vector<uint8_t> &types) {
+    size_t begin = next, bytes = 0;
+    while (next < vals.size() && bytes < result_chunk_bytes) {
+      if (vals[next].size() != types.size())
+        throw std::runtime_error(
+            fmt::format("row {} has {} values, expected {}", next,
+                        vals[next].size(), types.size()));
+      for (size_t i = 0; i < types.size(); i++)
+        bytes += types[i] == COLUMN_INT64 ? 8 : 4 + vals[next][i].size();
+      next++;
+    }
+
+    std::string chunk;
+    chunk.reserve(bytes + 4);
+    append_raw<uint32_t>(chunk, next - begin);
+    for (size_t i = 0; i < types.size(); i++)
+      for (size_t r = begin; r < next; r++) {
+        if (types[i] == COLUMN_INT64) {
+          int64_t v = 0;
+          parse_int64(vals[r][i], v);
+          append_raw<int64_t>(chunk, v);
+        } else {
+          append_raw<uint32_t>(chunk, vals[r][i].size());
+          chunk += vals[r][i];
+        }
+      }
+
+    for (size_t r = begin; r < next; r++)
+      std::vector<std::string>().swap(vals[r]);
+    return chunk;
+  }
+
+  // rows are encoded one chunk at a time and freed once sent, so the
+  // encoding of the whole result never exists at once
+  seastar::future<> stream_result(Connection &conn, uint32_t id,
+                                  std::vector<std::vector<std::string>> vals,
+                                  bool binary, bool rows,
+                                  const std::string &dbname) {
+    if (binary && !rows) {
+      std::string status;
+      for (auto &&row : vals)
+        status += boost::join(row, "\t") + "\n";
+      return write_frame(conn, id, FRAME_END, status);
+    }
+
+    std::vector<uint8_t> types;
+    std::string schema;
+    size_t first = 0;
+    if (binary) {
+      std::vector<std::string> names;
+      if (vals.size()) {
+        types = column_types(dbname, vals);
+        names = vals[0];
+        first = 1;
+      }
+      schema = schema_frame(names, types);
+    }
+
+    auto sent = binary ? write_frame(conn, id, FRAME_SCHEMA, schema)
+                       : seastar::make_ready_future<>();
+
+    return sent.then([this, &conn, id, vals = std::move(vals), binary,
+                      types = std::move(types), first]() mutable {
+      return seastar::do_with(
+          std::move(vals), first, std::move(types),
+          [this, &conn, id, binary](auto &vals, auto &next, auto &types) {
+            return seastar::repeat([this, &conn, id, binary, &vals, &next,
+                                    &types] {
+                     if (next == vals.size())
                        return seastar::make_ready_future<
                            seastar::stop_iteration>(
                            seastar::stop_iteration::yes);
-                     return pengine
-                         ->exec_sql(std::string(buf.get(), buf.size()))
-                         .handle_exception_type(
-                             [](std::exception &e)
-                                 -> std::vector<std::vector<std::string>> {
-                               return {{e.what()}};
-                             })
-                         .then([&out](auto vals) {
-                           std::stringstream ss;
-                           for (auto &&v1 : vals) {
-                             for (auto &&v2 : v1)
-                               ss << v2 << '\t';
-                             ss << std::endl;
-                           }
-                           ss << "DONE TOTAL " << vals.size() - 1 << " LINES\n";
-
-                           auto str = ss.str();
-
-                           std::string str1(str.size() + 4, ' ');
-                           memcpy(str1.data() + 4, str.data(), str.size());
-                           *(int *)(str1.data()) = str.size();
-
-                           return out
-                               .write(seastar::temporary_buffer<char>(
-                                   str1.data(), str1.size()))
-                               .then([&out] { return out.flush(); })
-                               .then(
-                                   [] { return seastar::stop_iteration::no; });
-                         });
-                   });
+
+                     auto chunk = binary ? batch_chunk(vals, next, types)
+                                         : text_chunk(vals, next);
+                     auto kind = binary ? FRAME_BATCH : FRAME_DATA;
+
+                     return write_frame(conn, id, kind, chunk).then([] {
+                       return seastar::stop_iteration::no;
+                     });
+                   })
+                .then([this, &conn, id, &vals] {
+                  size_t rows = vals.empty() ? 0 : vals.size() - 1;
+                  return write_frame(
+                      conn, id, FRAME_END,
+                      fmt::format("DONE TOTAL {} LINES\n", rows));
+                });
+          });
+    });
+  }
+
+  // "format text" or "format binary", answered with an end frame
+  seastar::future<> set_format(Connection &conn, uint32_t id,
+                               std::string sql) {
+    std::vector<std::string> tokens;
+    boost::split(tokens, sql, boost::is_any_of(" \t;"),
+                 boost::token_compress_on);
+
+    if (tokens.size() > 1 && tokens[1] == "binary") {
+      conn.binary = true;
+      return write_frame(conn, id, FRAME_END, "format binary\n");
+    } else if (tokens.size() > 1 && tokens[1] == "text") {
+      conn.binary = false;
+      return write_frame(conn, id, FRAME_END, "format text\n");
+    }
+
+    return write_frame(conn, id, FRAME_ERROR, "usage: format text|binary\n");
+  }
+
+  void reap_cursors(Connection &conn) {
+    auto now = seastar::lowres_clock::now();
+    for (auto it = conn.cursors.begin(); it != conn.cursors.end();) {
+      auto &&cur = it->second;
+      if (cur->busy.available_units() && now - cur->last_used > cursor_idle)
+        it = conn.cursors.erase(it);
+      else
+        it++;
+    }
+
+    if (conn.cursors.empty())
+      conn.cursor_reaper.cancel();
+  }
+
+  seastar::future<std::vector<std::vector<std::string>>>
+  declare_cursor(Connection &conn, std::string sql) {
+    std::istringstream ss(sql);
+    std::string declare, name, rest;
+    ss >> declare >> name;
+    std::getline(ss, rest, '\0');
+    boost::trim(rest);
+    if (boost::starts_with(rest, "cursor for"))
+      rest = boost::trim_copy(rest.substr(10));
+
+    if (name.empty() || !boost::starts_with(rest, "select"))
+      return seastar::make_exception_future<
+          std::vector<std::vector<std::string>>>(std::runtime_error(
+          "usage: declare <name> [cursor for] <select>"));
+
+    auto cur = std::make_shared<Cursor>();
+    cur->dbname = conn.dbname;
+    cur->sql = rest;
+    cur->plan = pengine->plan_scan_sql(conn.dbname, rest);
+    conn.cursors[name] = cur;
+
+    if (!conn.cursor_reaper.armed()) {
+      conn.cursor_reaper.set_callback([this, &conn] { reap_cursors(conn); });
+      conn.cursor_reaper.arm_periodic(
+          std::max(cursor_idle / 4, std::chrono::milliseconds(100)));
+    }
+
+    return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
+        std::vector<std::vector<std::string>>{{"declared"}});
+  }
+
+  // the next rows of a query that ran to completion on its first fetch
+  seastar::future<std::vector<std::vector<std::string>>>
+  fetch_materialized(std::shared_ptr<Cursor> cur, size_t count) {
+    auto run = seastar::make_ready_future<>();
+    if (!cur->ran) {
+      size_t kb;
+      auto &cls = query_class(cur->dbname, cur->sql, kb);
+      run = admit(cls, kb, [this, cur] {
+              return pengine->exec_sql(cur->dbname, cur->sql);
+            }).then([cur](auto rows) {
+        cur->rows = std::move(rows);
+        cur->ran = true;
+      });
+    }
+
+    return run.then([cur, count] {
+      std::vector<std::vector<std::string>> page;
+      if (cur->rows.empty())
+        return page;
+
+      page.push_back(cur->rows[0]);
+      while (cur->next < cur->rows.size() && page.size() <= count)
+        page.push_back(std::move(cur->rows[cur->next++]));
+      return page;
+    });
+  }
+
+  // pages of the fragment scans, each continuing after the last rowid read
+  seastar::future<std::vector<std::vector<std::string>>>
+  fetch_scanned(std::shared_ptr<Cursor> cur, size_t count) {
+    return seastar::do_with(
+        std::vector<std::vector<std::string>>{cur->plan->header},
+        [this, cur, count](auto &page) {
+          return seastar::repeat([this, cur, count, &page] {
+                   auto &&scans = cur->plan->scans;
+                   size_t want = count + 1 - page.size();
+                   if (want == 0 || cur->scan == scans.size())
+                     return seastar::make_ready_future<
+                         seastar::stop_iteration>(
+                         seastar::stop_iteration::yes);
+
+                   return pengine
+                       ->fetch_scan_page(cur->dbname, *cur->plan,
+                                         scans[cur->scan], cur->after, want)
+                       .then([cur, want, &page](auto rows) {
+                         for (size_t r = 1; r < rows.size(); r++) {
+                           parse_int64(rows[r][0], cur->after);
+                           rows[r].erase(rows[r].begin());
+                           page.push_back(std::move(rows[r]));
+                         }
+
+                         if (rows.size() < want + 1) {
+                           cur->scan++;
+                           cur->after = std::numeric_limits<int64_t>::min();
+                         }
+                         return seastar::stop_iteration::no;
+                       });
                  })
-              .then([&out] { return out.close(); });
+              .then([&page] { return std::move(page); });
+        });
+  }
+
+  seastar::future<std::vector<std::vector<std::string>>>
+  fetch_cursor(Connection &conn, std::string sql) {
+    std::vector<std::string> tokens;
+    boost::split(tokens, sql, boost::is_any_of(" \t;"),
+                 boost::token_compress_on);
+    if (tokens.size() && tokens.back().empty())
+      tokens.pop_back();
+
+    int64_t count = 0;
+    auto name = tokens.size() ? tokens.back() : "";
+    auto it = conn.cursors.find(name);
+    if (tokens.size() < 3 || tokens.size() > 4 ||
+        !parse_int64(tokens[1], count) || count <= 0 ||
+        (tokens.size() == 4 && tokens[2] != "from"))
+      return seastar::make_exception_future<
+          std::vector<std::vector<std::string>>>(
+          std::runtime_error("usage: fetch <n> [from] <name>"));
+
+    if (it == conn.cursors.end())
+      return seastar::make_exception_future<
+          std::vector<std::vector<std::string>>>(
+          std::runtime_error("no cursor " + name));
+
+    // fetches of one cursor run one after another
+    auto cur = it->second;
+    return seastar::with_semaphore(cur->busy, 1, [this, cur, count] {
+      cur->last_used = seastar::lowres_clock::now();
+      auto page = cur->plan ? fetch_scanned(cur, count)
+                            : fetch_materialized(cur, count);
+      return page.finally(
+          [cur] { cur->last_used = seastar::lowres_clock::now(); });
+    });
+  }
+
+  seastar::future<std::vector<std::vector<std::string>>>
+  close_cursor(Connection &conn, std::vector<std::string> &tokens) {
+    if (tokens.size() && tokens.back().empty())
+      tokens.pop_back();
+
+    if (tokens.size() != 3)
+      return seastar::make_exception_future<
+          std::vector<std::vector<std::string>>>(
+          std::runtime_error("usage: close cursor <name>"));
+
+    if (!conn.cursors.erase(tokens[2]))
+      return seastar::make_exception_future<
+          std::vector<std::vector<std::string>>>(
+          std::runtime_error("no cursor " + tokens[2]));
+
+    return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
+        std::vector<std::vector<std::string>>{{"closed"}});
+  }
+
+  // the cursor commands of the connection, or nothing for other sql
+  std::optional<seastar::future<std::vector<std::vector<std::string>>>>
+  cursor_request(Connection &conn, const std::string &sql) {
+    std::vector<std::string> tokens;
+    boost::split(tokens, sql, boost::is_any_of(" \t;"),
+                 boost::token_compress_on);
+
+    if (tokens[0] == "declare")
+      return seastar::make_ready_future<>().then(
+          [this, &conn, sql] { return declare_cursor(conn, sql); });
+
+    if (tokens[0] == "fetch")
+      return fetch_cursor(conn, sql);
+
+    // "close <site>" stays the node command
+    if (tokens[0] == "close" && tokens.size() > 1 && tokens[1] == "cursor")
+      return close_cursor(conn, tokens);
+
+    return {};
+  }
+
+  // the lowercased first word of sql
+  static std::string verb(const std::string &sql) {
+    auto space = [](unsigned char c) { return isspace(c); };
+    auto begin = std::find_if_not(sql.begin(), sql.end(), space);
+    auto end = std::find_if(begin, sql.end(), [&space](char c) {
+      return space(c) || c == ';';
+    });
+    return boost::to_lower_copy(std::string(begin, end));
+  }
+
+  // statements answered with a table, everything else answers a status
+  static bool returns_rows(const std::string &verb) {
+    return verb == "select" || verb == "fetch" || verb == "adviseindex";
+  }
+
+  // lookups, dml and commands are interactive. a select reading more than
+  // one fragment is analytic and is expected to need fragment_read_kb for
+  // every fragment it reads
+  QueryClass &query_class(const std::string &dbname, const std::string &sql,
+                          size_t &kb) {
+    kb = 0;
+    auto word = verb(sql);
+    if (word == "import")
+      return imports;
+    if (word != "select")
+      return interactive;
+
+    auto reads = pengine->fragment_reads(dbname, sql);
+    if (reads <= 1)
+      return interactive;
+
+    kb = std::min(reads * fragment_read_kb, query_memory_kb);
+    return analytic;
+  }
+
+  // runs func once a slot of its class and kb of query memory are free
+  template <typename Func>
+  seastar::future<std::vector<std::vector<std::string>>>
+  admit(QueryClass &cls, size_t kb, Func func) {
+    return seastar::get_units(cls.slots, 1)
+        .then([this, &cls, kb, func = std::move(func)](auto slot) mutable {
+          return seastar::get_units(query_memory, kb)
+              .then([&cls, func = std::move(func),
+                     slot = std::move(slot)](auto memory) mutable {
+                return seastar::with_scheduling_group(cls.group,
+                                                      std::move(func))
+                    .finally([slot = std::move(slot),
+                              memory = std::move(memory)] {});
+              });
+        });
+  }
+
+  // "usedb <name>" only switches this connection. a request runs against
+  // the database of its connection when it was read, so requests queued
+  // behind a usedb see the new database
+  seastar::future<std::vector<std::vector<std::string>>>
+  use_db(Connection &conn, std::string sql) {
+    std::vector<std::string> tokens;
+    boost::split(tokens, sql, boost::is_any_of(" \t;"),
+                 boost::token_compress_on);
+
+    if (tokens.size() < 2 || tokens[1].empty())
+      return seastar::make_exception_future<
+          std::vector<std::vector<std::string>>>(
+          std::runtime_error("usage: usedb <name>"));
+
+    conn.dbname = tokens[1];
+    return seastar::make_ready_future<std::vector<std::vector<std::string>>>(
+        std::vector<std::vector<std::string>>{{"changed"}});
+  }
+
+  seastar::future<> run_request(Connection &conn, uint32_t id,
+                                std::string sql) {
+    if (boost::starts_with(sql, "format"))
+      return set_format(conn, id, sql);
+
+    auto result = seastar::make_ready_future<
+        std::vector<std::vector<std::string>>>();
+    if (boost::starts_with(sql, "usedb")) {
+      result = use_db(conn, sql);
+    } else if (auto cursor = cursor_request(conn, sql)) {
+      result = std::move(*cursor);
+    } else {
+      size_t kb;
+      auto &cls = query_class(conn.dbname, sql, kb);
+      result = admit(cls, kb, [this, dbname = conn.dbname, sql] {
+        return pengine->exec_sql(dbname, sql);
+      });
+    }
+
+    bool binary = conn.binary, rows = returns_rows(verb(sql));
+    return std::move(result)
+        .then([this, &conn, id, binary, rows,
+               dbname = conn.dbname](auto vals) {
+          return stream_result(conn, id, std::move(vals), binary, rows,
+                               dbname);
+        })
+        .handle_exception_type([this, &conn, id](std::exception &e) {
+          return write_frame(conn, id, FRAME_ERROR,
+                             std::string(e.what()) + "\n");
+        })
+        .handle_exception([id](std::exception_ptr ep) {
+          fmt::print(stderr, "Could not answer request {}: {}\n", id, ep);
+        });
+  }
+
+  seastar::future<seastar::stop_iteration> read_request(Connection &conn) {
+    return conn.in.read_exactly(8).then([this, &conn](auto header) {
+      if (header.size() < 8)
+        return seastar::make_ready_future<seastar::stop_iteration>(
+            seastar::stop_iteration::yes);
+
+      uint32_t len, id;
+      memcpy(&len, header.get(), 4);
+      memcpy(&id, header.get() + 4, 4);
+
+      // the length is not trusted with an allocation of its size
+      if (len > max_frame_bytes)
+        return write_frame(conn, id, FRAME_ERROR,
+                           fmt::format("request of {} bytes is over {}\n",
+                                       len, max_frame_bytes))
+            .then([] { return seastar::stop_iteration::yes; });
+
+      return conn.in.read_exactly(len).then([this, &conn, len,
+                                             id](auto payload) {
+        if (payload.size() < len)
+          return seastar::make_ready_future<seastar::stop_iteration>(
+              seastar::stop_iteration::yes);
+
+        std::string sql(payload.get(), payload.size());
+
+        // the connection is not read further while max_inflight of its
+        // requests are running
+        return seastar::get_units(conn.inflight, 1)
+            .then([this, &conn, id, sql = std::move(sql)](auto units) mutable {
+              (void)seastar::with_gate(
+                  conn.requests, [this, &conn, id, sql = std::move(sql),
+                                  units = std::move(units)]() mutable {
+                    return run_request(conn, id, std::move(sql))
+                        .finally([units = std::move(units)] {});
+                  });
+              return seastar::stop_iteration::no;
+            });
+      });
+    });
+  }
+
+public:
+  TcpCliEngine(SqlRpcEngine *pengine, const AppConfig &config)
+      : pengine(pengine), max_inflight(config.cli_max_inflight),
+        max_frame_bytes(config.cli_max_frame_bytes),
+        cursor_idle(config.cli_cursor_idle_ms),
+        interactive("cli-interactive", 1000, config.cli_max_interactive),
+        analytic("cli-analytic", 200, config.cli_max_analytic),
+        imports("cli-import", 100, config.cli_max_imports),
+        fragment_read_kb(config.cli_fragment_read_kb),
+        query_memory_kb(config.cli_query_memory_mb * 1024),
+        query_memory(query_memory_kb) {}
+
+  seastar::future<> handle_connection(seastar::connected_socket s,
+                                      seastar::socket_address a) {
+    return seastar::do_with(
+        std::make_unique<Connection>(std::move(s), max_inflight),
+        [this](auto &conn) {
+          return seastar::repeat([this, &conn] { return read_request(*conn); })
+              .finally([&conn] { return conn->requests.close(); })
+              .finally([&conn] { return conn->out.close(); });
+        });
+  }
+
+  seastar::future<> create_scheduling_groups() {
+    return seastar::do_with(
+        std::vector<QueryClass *>{&interactive, &analytic, &imports},
+        [](auto &classes) {
+          return seastar::do_for_each(classes, [](QueryClass *cls) {
+            return seastar::create_scheduling_group(cls->name, cls->shares)
+                .then([cls](seastar::scheduling_group group) {
+                  cls->group = group;
+                });
+          });
         });
   }
 
   seastar::future<> service_loop(unsigned short port) {
+    return create_scheduling_groups().then(
+        [this, port] { return accept_loop(port); });
+  }
+
+  seastar::future<> accept_loop(unsigned short port) {
     seastar::listen_options lo;
     lo.reuse_address = false;
     return seastar::do_with(
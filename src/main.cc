@@ -42,6 +42,68 @@ AppConfig &loadConfig(const char *filename) {
     appconfig->sqldb_filename = node["sqlite"]["filename"].as<std::string>();
     appconfig->sqldb_initfile = node["sqlite"]["initfile"].as<std::string>();
     appconfig->frag_filename = node["fragfile"].as<std::string>();
+
+    if (node["insert-buffer"]) {
+      appconfig->insert_buffer_rows =
+          node["insert-buffer"]["rows"].as<size_t>();
+      appconfig->insert_buffer_ms = node["insert-buffer"]["ms"].as<unsigned>();
+
+      // rows 0 turns buffering off, which would ignore a flush interval
+      if (appconfig->insert_buffer_rows == 0 && appconfig->insert_buffer_ms)
+        throw std::runtime_error("insert-buffer: ms is set but rows is 0");
+
+      // a group is flushed as one transaction of at most a batch
+      if (appconfig->insert_buffer_rows > SqlRpcEngine::insert_batch_rows)
+        throw std::runtime_error(
+            "insert-buffer: rows is over " +
+            std::to_string(SqlRpcEngine::insert_batch_rows));
+    }
+
+    if (node["cli-max-inflight"])
+      appconfig->cli_max_inflight = node["cli-max-inflight"].as<size_t>();
+    if (node["cli-max-frame-bytes"])
+      appconfig->cli_max_frame_bytes =
+          node["cli-max-frame-bytes"].as<uint32_t>();
+    if (node["cli-cursor-idle-ms"])
+      appconfig->cli_cursor_idle_ms =
+          node["cli-cursor-idle-ms"].as<unsigned>();
+
+    if (auto admission = node["cli-admission"]) {
+      if (admission["interactive"])
+        appconfig->cli_max_interactive =
+            admission["interactive"].as<size_t>();
+      if (admission["analytic"])
+        appconfig->cli_max_analytic = admission["analytic"].as<size_t>();
+      if (admission["imports"])
+        appconfig->cli_max_imports = admission["imports"].as<size_t>();
+      if (admission["memory-mb"])
+        appconfig->cli_query_memory_mb = admission["memory-mb"].as<size_t>();
+      if (admission["fragment-read-kb"])
+        appconfig->cli_fragment_read_kb =
+            admission["fragment-read-kb"].as<size_t>();
+    }
+
+    if (auto limits = node["rpc-limits"]) {
+      if (limits["scans"])
+        appconfig->rpc_max_scans = limits["scans"].as<size_t>();
+      if (limits["query-nodes"])
+        appconfig->rpc_max_query_nodes = limits["query-nodes"].as<size_t>();
+      if (limits["inserts"])
+        appconfig->rpc_max_inserts = limits["inserts"].as<size_t>();
+      if (limits["memory-mb"])
+        appconfig->rpc_server_memory_mb = limits["memory-mb"].as<size_t>();
+    }
+
+    if (auto advisor = node["index-advisor"]) {
+      if (advisor["min-hits"])
+        appconfig->index_advisor_min_hits = advisor["min-hits"].as<size_t>();
+      if (advisor["max-selectivity"])
+        appconfig->index_advisor_max_selectivity =
+            advisor["max-selectivity"].as<double>();
+      if (advisor["interval-ms"])
+        appconfig->index_advisor_interval_ms =
+            advisor["interval-ms"].as<unsigned>();
+    }
   }
 
   return *appconfig;
@@ -64,7 +126,7 @@ int main(int argc, char **argv) {
     using namespace std::chrono_literals;
 
     psqlengine = new SqlRpcEngine(server_config);
-    pcliengine = new TcpCliEngine(psqlengine);
+    pcliengine = new TcpCliEngine(psqlengine, server_config);
 
     qpFragInit();
 
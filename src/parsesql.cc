@@ -11,17 +11,29 @@
 #include <boost/algorithm/string/case_conv.hpp>
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/constants.hpp>
+#include <algorithm>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/trim.hpp>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <exception>
+#include <fcntl.h>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
 #include <queue>
 #include <set>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <tuple>
 #include <typeinfo>
+#include <unistd.h>
 #include <variant>
 
 std::string format_column_name(std::string table, std::string column) {
@@ -303,37 +315,156 @@ void pushDownAndOptimize(BasicNode *now,
       rtable->select_conds = sel_conds;
 
     // check conditions
-    for (auto cond1 : sel_conds)
-      for (auto cond2 : sel_conds) {
-        if (cond1.val1 != cond2.val1)
-          continue;
-
-        if (cond1.val2.index() == 0) {
-          if ((cond1.op == CompareOps::LE || cond1.op == CompareOps::LT ||
-               cond1.op == CompareOps::EQ) &&
-              ((cond2.op == CompareOps::GE || cond2.op == CompareOps::GT ||
-                cond2.op == CompareOps::EQ))) {
-            int64_t end = std::get<0>(cond1.val2);
-            if (cond1.op == CompareOps::LE || cond1.op == CompareOps::EQ)
-              end++;
-
-            int64_t start = std::get<0>(cond2.val2);
-            if (cond2.op == CompareOps::GT)
-              start++;
-
-            if (end <= start) {
-              rtable->disabled = true;
-              return;
-            }
-          }
-        } else if (cond1.op == CompareOps::EQ && cond2.op == CompareOps::EQ) {
-          if (std::get<1>(cond1.val2) != std::get<1>(cond2.val2)) {
-            rtable->disabled = true;
-            return;
-          }
+    if (condsUnsatisfiable(sel_conds))
+      rtable->disabled = true;
+  }
+}
+
+// true when no row can satisfy all conds, e.g. a fragment predicate
+// id < 100 together with a query predicate id >= 200
+bool condsUnsatisfiable(const std::vector<CompareConds> &conds) {
+  for (auto &&cond1 : conds)
+    for (auto &&cond2 : conds) {
+      if (cond1.val1 != cond2.val1 || cond1.val2.index() != cond2.val2.index())
+        continue;
+
+      if (cond1.val2.index() == 0) {
+        if ((cond1.op == CompareOps::LE || cond1.op == CompareOps::LT ||
+             cond1.op == CompareOps::EQ) &&
+            ((cond2.op == CompareOps::GE || cond2.op == CompareOps::GT ||
+              cond2.op == CompareOps::EQ))) {
+          int64_t end = std::get<0>(cond1.val2);
+          if (cond1.op == CompareOps::LE || cond1.op == CompareOps::EQ)
+            end++;
+
+          int64_t start = std::get<0>(cond2.val2);
+          if (cond2.op == CompareOps::GT)
+            start++;
+
+          if (end <= start)
+            return true;
         }
+      } else if (cond1.op == CompareOps::EQ && cond2.op == CompareOps::EQ) {
+        if (std::get<1>(cond1.val2) != std::get<1>(cond2.val2))
+          return true;
+      }
+    }
+
+  return false;
+}
+
+// a where clause made only of column-literal comparisons joined by and.
+// column names lose their table part. anything else is rejected, since
+// dropping a predicate would widen a delete or update
+std::vector<CompareConds> processWhereConds(hsql::Expr *where) {
+  std::vector<CompareConds> conds;
+  std::vector<hsql::Expr *> exprs;
+
+  while (where && where->isType(hsql::kExprOperator) &&
+         where->opType == hsql::kOpAnd) {
+    exprs.push_back(where->expr2);
+    where = where->expr;
+  }
+  if (where)
+    exprs.push_back(where);
+
+  for (auto expr : exprs) {
+    if (!expr->isType(hsql::kExprOperator) ||
+        !(expr->opType == hsql::kOpEquals || expr->opType == hsql::kOpLess ||
+          expr->opType == hsql::kOpLessEq ||
+          expr->opType == hsql::kOpGreater ||
+          expr->opType == hsql::kOpGreaterEq) ||
+        !expr->expr->isType(hsql::kExprColumnRef) || !expr->expr2 ||
+        !(expr->expr2->isType(hsql::kExprLiteralInt) ||
+          expr->expr2->isType(hsql::kExprLiteralString)))
+      throw std::runtime_error("unsupported where condition");
+
+    auto cond = processCond(expr, "");
+    cond->val1 = std::get<1>(split_column_name(cond->val1));
+    conds.push_back(*cond);
+  }
+
+  return conds;
+}
+
+DeleteStmt parseDeleteStmt(std::string sql, DatabaseMetadata *db) {
+  DeleteStmt ret;
+  hsql::SQLParserResult result;
+  hsql::SQLParser::parse(sql, &result);
+
+  if (result.isValid() && result.size() > 0) {
+    const hsql::SQLStatement *statement = result.getStatement(0);
+
+    if (statement->isType(hsql::kStmtDelete)) {
+      const auto *del = static_cast<const hsql::DeleteStatement *>(statement);
+
+      ret.table_name = del->tableName;
+      ret.conds = processWhereConds(del->expr);
+    } else {
+      throw std::runtime_error("not delete statement");
+    }
+  } else {
+    throw std::runtime_error(result.errorMsg());
+  }
+
+  return ret;
+}
+
+UpdateStmt parseUpdateStmt(std::string sql, DatabaseMetadata *db) {
+  UpdateStmt ret;
+  hsql::SQLParserResult result;
+  hsql::SQLParser::parse(sql, &result);
+
+  if (result.isValid() && result.size() > 0) {
+    const hsql::SQLStatement *statement = result.getStatement(0);
+
+    if (statement->isType(hsql::kStmtUpdate)) {
+      const auto *update =
+          static_cast<const hsql::UpdateStatement *>(statement);
+
+      ret.table_name = update->table->getName();
+      for (auto clause : *update->updates) {
+        std::variant<int64_t, std::string> val;
+        if (clause->value->isType(hsql::kExprLiteralInt))
+          val = clause->value->ival;
+        else if (clause->value->isType(hsql::kExprLiteralString))
+          val = std::string(clause->value->getName());
+        else
+          throw std::runtime_error("unsupported update value");
+
+        // named like the where columns of processWhereConds
+        ret.sets.emplace_back(format_column_name("", clause->column), val);
       }
+      ret.conds = processWhereConds(update->where);
+    } else {
+      throw std::runtime_error("not update statement");
+    }
+  } else {
+    throw std::runtime_error(result.errorMsg());
+  }
+
+  return ret;
+}
+
+// the column every vertical fragment holds, used to join them back
+std::string vfragJoinColumn(TableMetadata &table_info) {
+  auto &&vfragcols = table_info.vfrag_cols;
+  auto &&firstfrag = *vfragcols.begin();
+  std::set<std::string> common_cols(std::get<1>(firstfrag.second).begin(),
+                                    std::get<1>(firstfrag.second).end());
+
+  for (auto &&[sname, fraginfo] : vfragcols) {
+    auto &&[fname, cols] = fraginfo;
+
+    decltype(common_cols) new_common_cols;
+    for (auto &&cname : common_cols) {
+      if (std::find(cols.begin(), cols.end(), cname) != cols.end())
+        new_common_cols.insert(cname);
+    }
+    common_cols = new_common_cols;
   }
+
+  return *common_cols.begin();
 }
 
 void processCreateMeta(std::string create_frag_stmt, DatabaseMetadata *db) {
@@ -355,7 +486,12 @@ void processCreateMeta(std::string create_frag_stmt, DatabaseMetadata *db) {
     // format error
     return;
   }
-  if (boost::to_lower_copy(tokens[1]) == "v") {
+  if (boost::to_lower_copy(tokens[1]) == "k") {
+    db->tables[tokens[4]].pk_index = tokens[2];
+  } else if (boost::to_lower_copy(tokens[1]) == "i") {
+    std::vector<std::string> cols(tokens.begin() + 6, tokens.end());
+    db->tables[tokens[4]].indexes[tokens[2]] = cols;
+  } else if (boost::to_lower_copy(tokens[1]) == "v") {
     auto [sitename, fragname] = split_column_name(tokens[2]);
     auto tablename = tokens[4];
     std::vector<std::string> cols;
@@ -409,6 +545,7 @@ void processCreateMeta(std::string create_frag_stmt, DatabaseMetadata *db) {
 
     db->tables[tablename].hfrag_conds[sitename] =
         std::make_tuple(fragname, conds);
+    db->tables[tablename].router.reset();
   } else if (boost::to_lower_copy(tokens[1]) == "t") {
     auto tablename = tokens[2];
     db->tables[tablename].name = tablename;
@@ -474,28 +611,8 @@ std::shared_ptr<BasicNode> buildDistributedReadNode(std::string tablename,
   if (table_info.frag_type == table_info.VFRAG) {
     auto join_node = std::make_shared<NJoinNode>();
     join_node->change_all_table_name = tablename;
-    std::string join_col;
-
     // find out common columns
-    {
-      auto &&vfragcols = table_info.vfrag_cols;
-      auto &&firstfrag = *vfragcols.begin();
-      std::set<std::string> common_cols(std::get<1>(firstfrag.second).begin(),
-                                        std::get<1>(firstfrag.second).end());
-
-      for (auto &&[sname, fraginfo] : vfragcols) {
-        auto &&[fname, cols] = fraginfo;
-
-        decltype(common_cols) new_common_cols;
-        for (auto &&cname : common_cols) {
-          if (std::find(cols.begin(), cols.end(), cname) != cols.end())
-            new_common_cols.insert(cname);
-        }
-        common_cols = new_common_cols;
-      }
-
-      join_col = *common_cols.begin();
-    }
+    std::string join_col = vfragJoinColumn(table_info);
 
     for (auto &&[sname, fraginfo] : table_info.vfrag_cols) {
       auto &&[fname, cols] = fraginfo;
@@ -660,6 +777,196 @@ bool checkFragCond(std::vector<std::variant<int64_t, std::string>> &row,
   return true;
 }
 
+static std::shared_ptr<FragRouter> compileFragRouter(TableMetadata &table) {
+  auto router = std::make_shared<FragRouter>();
+  std::map<std::string, int> int_index, str_index;
+
+  // every int predicate becomes bounds of half open intervals
+  for (auto &&[sname, sdata] : table.hfrag_conds) {
+    auto &&[fname, conds] = sdata;
+    router->frag_sites.push_back(sname);
+
+    for (auto &&cond : conds) {
+      if (cond.val2.index() == 0) {
+        if (str_index.count(cond.val1))
+          return router;
+
+        if (int_index.count(cond.val1) == 0) {
+          int_index[cond.val1] = router->int_columns.size();
+          router->int_columns.push_back({cond.val1, {}});
+        }
+
+        auto &bounds = router->int_columns[int_index[cond.val1]].bounds;
+        int64_t val = std::get<0>(cond.val2);
+
+        if (cond.op == CompareOps::LT || cond.op == CompareOps::GE)
+          bounds.push_back(val);
+        else if (cond.op == CompareOps::LE || cond.op == CompareOps::GT)
+          bounds.push_back(val + 1);
+        else {
+          bounds.push_back(val);
+          bounds.push_back(val + 1);
+        }
+      } else {
+        if (cond.op != CompareOps::EQ || int_index.count(cond.val1))
+          return router;
+
+        if (str_index.count(cond.val1) == 0) {
+          str_index[cond.val1] = router->str_columns.size();
+          router->str_columns.push_back({cond.val1, {}});
+        }
+
+        auto &values = router->str_columns[str_index[cond.val1]].values;
+        values.emplace(std::get<1>(cond.val2), values.size() + 1);
+      }
+    }
+  }
+
+  // value 0 of a string column stands for every string not compared with
+  size_t ncells = 1;
+  for (auto &&col : router->int_columns) {
+    std::sort(col.bounds.begin(), col.bounds.end());
+    col.bounds.erase(std::unique(col.bounds.begin(), col.bounds.end()),
+                     col.bounds.end());
+
+    router->strides.push_back(ncells);
+    ncells *= col.bounds.size() + 1;
+  }
+  for (auto &&col : router->str_columns) {
+    router->strides.push_back(ncells);
+    ncells *= col.values.size() + 1;
+  }
+
+  if (ncells > (1 << 20))
+    return router;
+
+  // evaluate the predicates once per cell on a value inside it
+  std::vector<std::string> str_values(router->str_columns.size());
+  router->cells.assign(ncells, -1);
+
+  for (size_t cell = 0; cell < ncells; cell++) {
+    std::map<std::string, std::variant<int64_t, std::string>> sample;
+    std::set<std::string> unmatched_strs;
+
+    for (int i = 0; i < router->int_columns.size(); i++) {
+      auto &&bounds = router->int_columns[i].bounds;
+      size_t bucket = cell / router->strides[i] % (bounds.size() + 1);
+
+      if (bounds.empty())
+        sample[router->int_columns[i].name] = int64_t(0);
+      else if (bucket == 0)
+        sample[router->int_columns[i].name] = bounds[0] - 1;
+      else
+        sample[router->int_columns[i].name] = bounds[bucket - 1];
+    }
+
+    for (int i = 0; i < router->str_columns.size(); i++) {
+      auto &&col = router->str_columns[i];
+      auto stride = router->strides[router->int_columns.size() + i];
+      size_t id = cell / stride % (col.values.size() + 1);
+
+      if (id == 0)
+        unmatched_strs.insert(col.name);
+      for (auto &&[val, vid] : col.values)
+        if (vid == id)
+          sample[col.name] = val;
+    }
+
+    int frag = 0;
+    for (auto &&[sname, sdata] : table.hfrag_conds) {
+      auto &&[fname, conds] = sdata;
+      bool match = true;
+
+      for (auto &&cond : conds) {
+        if (unmatched_strs.count(cond.val1)) {
+          match = false;
+          break;
+        }
+
+        auto result = compareVar(sample[cond.val1], cond.val2);
+        if (!((cond.op == CompareOps::EQ && result == 0) ||
+              (cond.op == CompareOps::LE && result <= 0) ||
+              (cond.op == CompareOps::LT && result < 0) ||
+              (cond.op == CompareOps::GE && result >= 0) ||
+              (cond.op == CompareOps::GT && result > 0))) {
+          match = false;
+          break;
+        }
+      }
+
+      if (match) {
+        router->cells[cell] = frag;
+        break;
+      }
+      frag++;
+    }
+  }
+
+  router->compiled = true;
+  return router;
+}
+
+FragRouter &getFragRouter(TableMetadata &table) {
+  if (!table.router)
+    table.router = compileFragRouter(table);
+
+  return *table.router;
+}
+
+// route a batch column by column. returns the fragment index of every row,
+// -1 when no fragment matches and -2 when the row has to be checked with
+// checkFragCond; nullopt when a routing column is missing
+std::optional<std::vector<int>>
+routeRows(FragRouter &router, std::vector<std::string> &columns,
+          std::vector<std::vector<std::variant<int64_t, std::string>>> &rows) {
+  std::vector<size_t> cell(rows.size(), 0);
+  std::vector<char> fallback(rows.size(), 0);
+
+  auto column_pos = [&columns](const std::string &name) {
+    return std::find(columns.begin(), columns.end(), name) - columns.begin();
+  };
+
+  for (int i = 0; i < router.int_columns.size(); i++) {
+    auto &&bounds = router.int_columns[i].bounds;
+    auto stride = router.strides[i];
+    auto pos = column_pos(router.int_columns[i].name);
+    if (pos == columns.size())
+      return {};
+
+    for (size_t r = 0; r < rows.size(); r++) {
+      auto val = std::get_if<int64_t>(&rows[r][pos]);
+      fallback[r] |= !val;
+      if (val)
+        cell[r] += stride * (std::upper_bound(bounds.begin(), bounds.end(),
+                                              *val) -
+                             bounds.begin());
+    }
+  }
+
+  for (int i = 0; i < router.str_columns.size(); i++) {
+    auto &&values = router.str_columns[i].values;
+    auto stride = router.strides[router.int_columns.size() + i];
+    auto pos = column_pos(router.str_columns[i].name);
+    if (pos == columns.size())
+      return {};
+
+    for (size_t r = 0; r < rows.size(); r++) {
+      auto val = std::get_if<std::string>(&rows[r][pos]);
+      fallback[r] |= !val;
+      if (val) {
+        auto it = values.find(*val);
+        cell[r] += stride * (it == values.end() ? 0 : it->second);
+      }
+    }
+  }
+
+  std::vector<int> frags(rows.size());
+  for (size_t r = 0; r < rows.size(); r++)
+    frags[r] = fallback[r] ? -2 : router.cells[cell[r]];
+
+  return frags;
+}
+
 std::map<std::string, InsertStmt> insertStmtToSites(InsertStmt &istmt,
                                                     DatabaseMetadata *db) {
   std::map<std::string, InsertStmt> ret;
@@ -705,7 +1012,20 @@ std::map<std::string, InsertStmt> insertStmtToSites(InsertStmt &istmt,
           std::find(istmt.columns.begin(), istmt.columns.end(), col) -
           istmt.columns.begin();
 
-    for (auto &&data : istmt.values) {
+    auto &&router = getFragRouter(table_info);
+    std::optional<std::vector<int>> frags;
+    if (router.compiled)
+      frags = routeRows(router, istmt.columns, istmt.values);
+
+    for (size_t r = 0; r < istmt.values.size(); r++) {
+      auto &&data = istmt.values[r];
+
+      if (frags && (*frags)[r] != -2) {
+        if ((*frags)[r] >= 0)
+          ret[router.frag_sites[(*frags)[r]]].values.push_back(data);
+        continue;
+      }
+
       for (auto &&[sname, sdata] : table_info.hfrag_conds) {
         auto &&[fname, fcond] = sdata;
 
@@ -755,7 +1075,276 @@ InsertStmt insertStmtFromTSV(std::string table, std::string filename,
   return ret;
 }
 
+// parse the tsv rows in [begin, end), which starts and ends on a line
+// boundary. fields are located with memchr, which glibc vectorizes
+static InsertStmt parseTSVChunk(const char *begin, const char *end,
+                                const std::string &table,
+                                const std::vector<std::string> &columns,
+                                const std::vector<bool> &int_columns) {
+  InsertStmt ret;
+  ret.table_name = table;
+  ret.columns = columns;
+
+  while (begin < end) {
+    auto line_end = (const char *)memchr(begin, '\n', end - begin);
+    if (!line_end)
+      line_end = end;
+
+    std::vector<std::variant<int64_t, std::string>> values;
+    values.reserve(columns.size());
+
+    auto field = begin;
+    while (field < line_end) {
+      auto field_end = (const char *)memchr(field, '\t', line_end - field);
+      if (!field_end)
+        field_end = line_end;
+
+      // consecutive tabs are merged, as with token_compress_on
+      if (field_end != field) {
+        if (values.size() == columns.size()) {
+          values.emplace_back(std::string());
+          break;
+        }
+
+        if (int_columns[values.size()]) {
+          int64_t val;
+          auto [ptr, ec] = std::from_chars(field, field_end, val);
+          if (ec != std::errc() || ptr != field_end)
+            throw std::runtime_error(
+                fmt::format("bad int field in table {}: {}", table,
+                            std::string(field, field_end)));
+          values.emplace_back(val);
+        } else
+          values.emplace_back(std::string(field, field_end));
+      }
+
+      field = field_end + 1;
+    }
+
+    if (values.size() == columns.size())
+      ret.values.push_back(std::move(values));
+
+    begin = line_end + 1;
+  }
+
+  return ret;
+}
+
+// a line belongs to the byte range holding its first byte, so ranges
+// cut anywhere in the file cover every line exactly once
+TSVChunkReader::TSVChunkReader(std::string table, std::string filename,
+                               DatabaseMetadata *db, size_t begin,
+                               size_t end, size_t chunk_bytes)
+    : table(table), db(db), chunk_bytes(chunk_bytes) {
+  auto &table_info = db->tables[table];
+  for (auto &&col : table_info.columns)
+    int_columns.push_back(table_info.column_type[col] == "int");
+
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("cannot open " + filename);
+
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    close(fd);
+    throw std::runtime_error("cannot stat " + filename);
+  }
+
+  size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    return;
+  }
+
+  data = (const char *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    data = nullptr;
+    throw std::runtime_error("cannot mmap " + filename);
+  }
+  madvise((void *)data, size, MADV_SEQUENTIAL);
+
+  auto line_start = [this](size_t pos) -> const char * {
+    if (pos == 0)
+      return data;
+    if (pos >= size)
+      return data + size;
+
+    auto nl = (const char *)memchr(data + pos - 1, '\n', size - pos + 1);
+    return nl ? nl + 1 : data + size;
+  };
+
+  now = line_start(begin);
+  this->end = line_start(end);
+}
+
+TSVChunkReader::~TSVChunkReader() {
+  if (data)
+    munmap((void *)data, size);
+}
+
+std::optional<std::map<std::string, InsertStmt>> TSVChunkReader::next() {
+  if (now >= end)
+    return {};
+
+  // cut right after a newline
+  auto chunk_end = end;
+  if ((size_t)(end - now) > chunk_bytes) {
+    auto nl = (const char *)memchr(now + chunk_bytes, '\n',
+                                   end - now - chunk_bytes);
+    chunk_end = nl ? nl + 1 : end;
+  }
+
+  auto chunk = parseTSVChunk(now, chunk_end, table, db->tables[table].columns,
+                             int_columns);
+  now = chunk_end;
+  return insertStmtToSites(chunk, db);
+}
+
+namespace {
+// cursor over an insert statement for parseSimpleInsertStmt
+struct InsertLexer {
+  const char *now, *end;
+
+  void skipSpaces() {
+    while (now < end && isspace((unsigned char)*now))
+      now++;
+  }
+
+  bool consume(char c) {
+    skipSpaces();
+    if (now < end && *now == c) {
+      now++;
+      return true;
+    }
+    return false;
+  }
+
+  bool keyword(const char *word) {
+    skipSpaces();
+    auto len = strlen(word);
+    if (end - now < len || strncasecmp(now, word, len) != 0)
+      return false;
+    if (now + len < end &&
+        (isalnum((unsigned char)now[len]) || now[len] == '_'))
+      return false;
+    now += len;
+    return true;
+  }
+
+  std::optional<std::string> identifier() {
+    skipSpaces();
+    auto begin = now;
+    if (now == end || !(isalpha((unsigned char)*now) || *now == '_'))
+      return {};
+    while (now < end && (isalnum((unsigned char)*now) || *now == '_'))
+      now++;
+    return std::string(begin, now);
+  }
+
+  std::optional<std::variant<int64_t, std::string>> literal() {
+    skipSpaces();
+    if (now == end)
+      return {};
+
+    if (*now == '\'') {
+      std::string val;
+      for (now++; now < end; now++) {
+        if (*now == '\'') {
+          if (now + 1 < end && now[1] == '\'') {
+            val.push_back('\'');
+            now++;
+          } else {
+            now++;
+            return val;
+          }
+        } else
+          val.push_back(*now);
+      }
+      return {};
+    }
+
+    auto begin = now;
+    if (*now == '-' || *now == '+')
+      now++;
+    while (now < end && isdigit((unsigned char)*now))
+      now++;
+
+    int64_t val;
+    auto digits = *begin == '+' ? begin + 1 : begin;
+    auto [ptr, ec] = std::from_chars(digits, now, val);
+    if (ec != std::errc() || ptr != now)
+      return {};
+    return val;
+  }
+};
+} // namespace
+
+// fast path for the plain "insert into T [(cols)] values (...), (...)"
+// shape with int and string literals; anything else goes to hsql
+std::optional<InsertStmt> parseSimpleInsertStmt(std::string sql,
+                                                DatabaseMetadata *db) {
+  InsertStmt ret;
+  InsertLexer lex{sql.data(), sql.data() + sql.size()};
+
+  if (!lex.keyword("insert") || !lex.keyword("into"))
+    return {};
+
+  auto table = lex.identifier();
+  if (!table)
+    return {};
+  ret.table_name = *table;
+
+  if (lex.consume('(')) {
+    do {
+      auto col = lex.identifier();
+      if (!col)
+        return {};
+      ret.columns.push_back(*col);
+    } while (lex.consume(','));
+
+    if (!lex.consume(')'))
+      return {};
+  } else
+    ret.columns = db->tables[ret.table_name].columns;
+
+  if (!lex.keyword("values"))
+    return {};
+
+  do {
+    if (!lex.consume('('))
+      return {};
+
+    ret.values.emplace_back();
+    do {
+      auto val = lex.literal();
+      if (!val)
+        return {};
+      ret.values.back().push_back(std::move(*val));
+    } while (lex.consume(','));
+
+    if (!lex.consume(')'))
+      return {};
+
+    if (ret.values.back().size() != ret.columns.size())
+      throw std::runtime_error(
+          fmt::format("insert into {} expects {} values, got {}",
+                      ret.table_name, ret.columns.size(),
+                      ret.values.back().size()));
+  } while (lex.consume(','));
+
+  lex.consume(';');
+  lex.skipSpaces();
+  if (lex.now != lex.end)
+    return {};
+
+  return ret;
+}
+
 InsertStmt parseInsertStmt(std::string sql, DatabaseMetadata *db) {
+  if (auto simple = parseSimpleInsertStmt(sql, db))
+    return *simple;
+
   InsertStmt ret;
   hsql::SQLParserResult result;
   hsql::SQLParser::parse(sql, &result);
@@ -898,3 +1487,127 @@ parseCreateTable(std::string create_sql, DatabaseMetadata *db,
 
   return ret;
 }
+
+// createindex table col1 col2 ...
+// every fragment holding all the columns gets its own sqlite index, the
+// catalog keeps "createmeta i name on table where col1 col2 ...". the entry
+// is only added to metas, the caller applies it once the index is built
+std::map<std::string, std::string>
+parseCreateIndex(std::string create_sql, DatabaseMetadata *db,
+                 std::vector<std::string> *metas) {
+  std::vector<std::string> tokens;
+  std::map<std::string, std::string> ret;
+
+  boost::trim_if(create_sql, boost::is_any_of(" \t;"));
+  boost::split(tokens, create_sql, boost::is_any_of(" \t,;"),
+               boost::token_compress_on);
+
+  if (tokens.size() < 3 || db->tables.count(tokens[1]) == 0)
+    throw std::runtime_error("usage: createindex <table> <cols>");
+
+  auto &&table_meta = db->tables[tokens[1]];
+  std::vector<std::string> cols(tokens.begin() + 2, tokens.end());
+  for (auto &&col : cols)
+    if (!table_meta.column_type.count(col))
+      throw std::runtime_error("unknown column " + col);
+
+  // analyze so sqlite's planner knows how selective the index is
+  auto index_sql = [&](std::string fname) {
+    auto index_name = "idx_" + fname + "_" + boost::algorithm::join(cols, "_");
+    return fmt::format("create index if not exists {} on {} ({}); analyze {};",
+                       index_name, fname, boost::algorithm::join(cols, ", "),
+                       index_name);
+  };
+
+  if (table_meta.frag_type == TableMetadata::HFRAG) {
+    for (auto &&[sname, sdata] : table_meta.hfrag_conds)
+      ret[sname] = index_sql(std::get<0>(sdata));
+  } else {
+    for (auto &&[sname, sdata] : table_meta.vfrag_cols) {
+      auto &&[fname, vcols] = sdata;
+
+      bool holds_all = true;
+      for (auto &&col : cols)
+        holds_all = holds_all &&
+                    std::find(vcols.begin(), vcols.end(), col) != vcols.end();
+
+      if (holds_all)
+        ret[sname] = index_sql(fname);
+    }
+  }
+
+  if (ret.empty())
+    throw std::runtime_error("no fragment holds all of the columns");
+
+  auto name = tokens[1] + "_" + boost::algorithm::join(cols, "_");
+  if (!table_meta.indexes.count(name) && metas)
+    metas->push_back(fmt::format("createmeta i {} on {} where {}", name,
+                                 tokens[1], boost::algorithm::join(cols, " ")));
+
+  return ret;
+}
+
+// createpkindex table col
+// recorded as "createmeta k col on table where col". a vertically
+// fragmented table can only index the column its fragments share
+std::string parseCreatePkIndex(std::string create_sql, DatabaseMetadata *db,
+                               std::vector<std::string> *metas) {
+  std::vector<std::string> tokens;
+
+  boost::trim_if(create_sql, boost::is_any_of(" \t;"));
+  boost::split(tokens, create_sql, boost::is_any_of(" \t;"),
+               boost::token_compress_on);
+
+  if (tokens.size() != 3 || db->tables.count(tokens[1]) == 0)
+    throw std::runtime_error("usage: createpkindex <table> <col>");
+
+  auto &&table_meta = db->tables[tokens[1]];
+  auto &&col = tokens[2];
+  if (!table_meta.column_type.count(col))
+    throw std::runtime_error("unknown column " + col);
+  if (table_meta.frag_type == TableMetadata::VFRAG &&
+      col != vfragJoinColumn(table_meta))
+    throw std::runtime_error(col + " is not held by every fragment");
+
+  if (table_meta.pk_index != col) {
+    auto meta =
+        fmt::format("createmeta k {} on {} where {}", col, tokens[1], col);
+    processCreateMeta(meta, db);
+
+    if (metas)
+      metas->push_back(meta);
+  }
+
+  return tokens[1];
+}
+
+// disable the reads of table outside sites, then recompute disabled the
+// way pushDownAndOptimize does
+void pruneReadSites(BasicNode *now, const std::string &table,
+                    const std::set<std::string> &sites) {
+  if (ProjectionNode *projection = dynamic_cast<ProjectionNode *>(now)) {
+    pruneReadSites(projection->child.get(), table, sites);
+    projection->disabled = projection->child->disabled;
+  } else if (SelectionNode *selection = dynamic_cast<SelectionNode *>(now)) {
+    pruneReadSites(selection->child.get(), table, sites);
+    selection->disabled = selection->child->disabled;
+  } else if (NJoinNode *njoin = dynamic_cast<NJoinNode *>(now)) {
+    bool disabled = false;
+    for (auto &&child : njoin->join_children) {
+      pruneReadSites(child.get(), table, sites);
+      disabled = disabled || child->disabled;
+    }
+    njoin->disabled = disabled;
+  } else if (UnionNode *union_node = dynamic_cast<UnionNode *>(now)) {
+    bool disabled = true;
+    for (auto &&child : union_node->union_children) {
+      pruneReadSites(child.get(), table, sites);
+      disabled = disabled && child->disabled;
+    }
+    union_node->disabled = disabled;
+  } else if (ReadTableNode *rtable = dynamic_cast<ReadTableNode *>(now)) {
+    auto site = std::get<0>(split_column_name(rtable->table_name));
+    if (rtable->orig_table_name == table && !sites.count(site))
+      rtable->disabled = true;
+  }
+}